@@ -0,0 +1,109 @@
+#ifndef ALIAS_H
+#define ALIAS_H
+
+#include "rng.h"
+
+#include <string>
+#include <vector>
+
+//--------------------------------------------------------
+// Walker's alias method with Vose's construction: a discrete distribution
+// over n outcomes becomes n columns, each holding its own outcome with
+// probability "m_prob" and an alias otherwise, so a sample costs one
+// uniform draw and one comparison whatever n is.
+
+class AliasTable
+{
+public:
+    AliasTable() {}
+
+    template< typename T >
+    explicit AliasTable( const std::vector< T >& weights ) { build( weights ); }
+
+    size_t size() const { return m_prob.size(); }
+
+    template< typename T >
+    void build( const std::vector< T >& weights )
+    {
+        const size_t n = weights.size();
+        if ( n == 0 )
+            throw std::string( "Empty distribution. " ).append( __FUNCTION__ );
+
+        double total = 0.0;
+        for ( size_t i = 0; i < n; ++i )
+            total += double( weights[i] );
+        if ( total <= 0.0 )
+            throw std::string( "Invalid distribution. " ).append( __FUNCTION__ );
+
+        m_prob.assign( n, 1.0 );
+        m_alias.resize( n );
+
+        std::vector< double > scaled( n );
+        std::vector< int > small;
+        std::vector< int > large;
+        for ( size_t i = 0; i < n; ++i )
+        {
+            m_alias[i] = int( i );
+            scaled[i] = double( weights[i] ) * n / total;
+            ( scaled[i] < 1.0 ? small : large ).push_back( int( i ) );
+        }
+
+        while ( !small.empty() && !large.empty() )
+        {
+            const int s = small.back();
+            const int l = large.back();
+            small.pop_back();
+
+            m_prob[s] = scaled[s];
+            m_alias[s] = l;
+            scaled[l] -= 1.0 - scaled[s];
+            if ( scaled[l] < 1.0 )
+            {
+                large.pop_back();
+                small.push_back( l );
+            }
+        }
+
+        // Whatever is left is 1 up to rounding.
+    }
+
+    int sample( Rng& rng ) const
+    {
+        return pick( rng.uniform() * m_prob.size() );
+    }
+
+    // Draws all uniforms first, then maps them in a loop without
+    // dependencies between iterations, which the compiler can vectorize.
+    void sample( Rng& rng, int* out, size_t count )
+    {
+        m_uniforms.resize( count );
+        for ( size_t i = 0; i < count; ++i )
+            m_uniforms[i] = rng.uniform();
+
+        const double n = double( m_prob.size() );
+        const double* prob = &m_prob[0];
+        const int* alias = &m_alias[0];
+        const double* u = count > 0 ? &m_uniforms[0] : 0;
+        for ( size_t i = 0; i < count; ++i )
+        {
+            const double x = u[i] * n;
+            const int column = int( x );
+            out[i] = x - column < prob[ column ] ? column : alias[ column ];
+        }
+    }
+
+private:
+    int pick( double x ) const
+    {
+        const int column = int( x );
+        return x - column < m_prob[ column ] ? column : m_alias[ column ];
+    }
+
+private:
+    std::vector< double > m_prob;
+    std::vector< int > m_alias;
+    std::vector< double > m_uniforms;
+};
+
+//--------------------------------------------------------
+#endif
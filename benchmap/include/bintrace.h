@@ -0,0 +1,235 @@
+#ifndef BINTRACE_H
+#define BINTRACE_H
+
+#include <string>
+#include <stdio.h>
+#include <string.h>
+#include <stddef.h>
+
+#ifdef _MSC_VER
+    #include <io.h>
+#else
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
+//--------------------------------------------------------
+// Binary trace: a fixed header followed by fixed-width records in native
+// byte order. "commTableInts" ints describing the "%comm" communicators
+// follow the header and precede the records. Records end after the last
+// field the trace uses: 16 bytes without delays and timestamps, up to the
+// delay with delays only, full width with timestamps; "recordSize" tells
+// which. "headerSize" lets later versions append header fields that older
+// readers skip.
+
+static const char BIN_TRACE_MAGIC[8] = { 'B', 'M', 'T', 'R', 'A', 'C', 'E', 0 };
+static const int BIN_TRACE_VERSION = 1;
+
+struct SBinTraceHeader
+{
+    char magic[8];
+    int version;
+    int recordSize;
+    int procsNum;
+    int bufSize;
+    int sleepTime;
+    int headerSize;
+    long long recordsNum;
+    long long transfered;
+    int sleepUs;
+    int delayMode;
+    int commTableInts;
+    int reserved;
+};
+
+struct SBinTraceRecord
+{
+    char kind;
+    char flags;
+    short reserved;
+    int from;
+    int to;
+    int size;
+    int delay;
+    int reserved2;
+    double time;
+};
+
+//--------------------------------------------------------
+
+// The narrowest record that holds the fields a trace uses.
+int binRecordSize( bool delays, bool times )
+{
+    if ( times )
+        return int( sizeof(SBinTraceRecord) );
+    return delays ? int( offsetof( SBinTraceRecord, time ) ) : int( offsetof( SBinTraceRecord, delay ) );
+}
+
+void initBinTraceHeader( SBinTraceHeader& header )
+{
+    memset( &header, 0, sizeof(header) );
+    memcpy( header.magic, BIN_TRACE_MAGIC, sizeof(BIN_TRACE_MAGIC) );
+    header.version = BIN_TRACE_VERSION;
+    header.recordSize = sizeof(SBinTraceRecord);
+    header.headerSize = sizeof(SBinTraceHeader);
+    header.sleepUs = -1;
+    header.delayMode = -1;
+}
+
+bool isBinTrace( const char* data, size_t length )
+{
+    return length >= sizeof(SBinTraceHeader) && 0 == memcmp( data, BIN_TRACE_MAGIC, sizeof(BIN_TRACE_MAGIC) );
+}
+
+bool readBinTraceHeader( const char* data, size_t length, SBinTraceHeader& header )
+{
+    if ( !isBinTrace( data, length ) )
+        return false;
+
+    memcpy( &header, data, sizeof(header) );
+    if ( header.headerSize < int( sizeof(header) ) || size_t( header.headerSize ) > length )
+        return false;
+    return true;
+}
+
+// Decodes one record of "recordSize" bytes; fields the trace does not use
+// keep their defaults.
+void readBinRecord( const char* data, int recordSize, SBinTraceRecord& rec )
+{
+    memset( &rec, 0, sizeof(rec) );
+    rec.delay = -1;
+    rec.time = -1.0;
+    memcpy( &rec, data, size_t( recordSize ) < sizeof(rec) ? size_t( recordSize ) : sizeof(rec) );
+}
+
+void fillBinRecord( SBinTraceRecord& rec, char kind, int from, int to, int size, int delay = -1, double time = -1.0 )
+{
+    memset( &rec, 0, sizeof(rec) );
+    rec.kind  = kind;
+    rec.from  = from;
+    rec.to    = to;
+    rec.size  = size;
+    rec.delay = delay;
+    rec.time  = time;
+}
+
+// Appends the first "recordSize" bytes of the record.
+void appendBinRecord( std::string& out, int recordSize, char kind, int from, int to, int size, int delay = -1, double time = -1.0 )
+{
+    SBinTraceRecord rec;
+    fillBinRecord( rec, kind, from, to, size, delay, time );
+    out.append( (const char*)&rec, size_t( recordSize ) );
+}
+
+// Bytes all "members" ranks together send for one collective of "size"
+// bytes. The "#transfered" total of a trace counts collectives this way.
+long long collectiveVolume( char kind, int size, int members )
+{
+    if ( kind == 'v' )
+        return (long long)size * members * ( members - 1 );
+    if ( kind == 'b' )
+        return (long long)size * ( members - 1 );
+    return (long long)size * members;
+}
+
+//--------------------------------------------------------
+// Read-only view of a file range. Uses mmap where available, so the records
+// are decoded straight from the page cache; falls back to a plain read.
+
+class TraceMapping
+{
+public:
+    TraceMapping()
+        : m_fd( -1 )
+    #ifdef _MSC_VER
+        , m_file( 0 )
+    #endif
+        , m_base( 0 )
+        , m_mapLength( 0 )
+        , m_data( 0 )
+    {}
+    ~TraceMapping() { unmap(); close(); }
+
+    bool open( const char* fileName )
+    {
+    #ifdef _MSC_VER
+        m_file = fopen( fileName, "rb" );
+        return m_file != 0;
+    #else
+        m_fd = ::open( fileName, O_RDONLY );
+        return m_fd >= 0;
+    #endif
+    }
+
+    void close()
+    {
+    #ifdef _MSC_VER
+        if ( m_file )
+            fclose( m_file );
+        m_file = 0;
+    #else
+        if ( m_fd >= 0 )
+            ::close( m_fd );
+        m_fd = -1;
+    #endif
+    }
+
+    const char* map( long long offset, size_t length )
+    {
+        unmap();
+        if ( length == 0 )
+            return 0;
+
+    #ifdef _MSC_VER
+        m_buf.resize( length );
+        _fseeki64( m_file, offset, SEEK_SET );
+        if ( fread( &m_buf[0], 1, length, m_file ) != length )
+            return 0;
+        m_data = &m_buf[0];
+    #else
+        const long long pageSize = sysconf( _SC_PAGESIZE );
+        const long long alignedOffset = offset - offset % pageSize;
+        m_mapLength = size_t( offset - alignedOffset ) + length;
+        void* addr = mmap( 0, m_mapLength, PROT_READ, MAP_PRIVATE, m_fd, off_t( alignedOffset ) );
+        if ( addr == MAP_FAILED )
+        {
+            m_mapLength = 0;
+            return 0;
+        }
+        madvise( addr, m_mapLength, MADV_SEQUENTIAL );
+        m_base = (char*)addr;
+        m_data = m_base + ( offset - alignedOffset );
+    #endif
+        return m_data;
+    }
+
+    void unmap()
+    {
+    #ifndef _MSC_VER
+        if ( m_base )
+            munmap( m_base, m_mapLength );
+    #endif
+        m_base = 0;
+        m_mapLength = 0;
+        m_data = 0;
+    }
+
+private:
+    TraceMapping( const TraceMapping& );
+    TraceMapping& operator=( const TraceMapping& );
+
+private:
+    int m_fd;
+#ifdef _MSC_VER
+    FILE* m_file;
+    std::string m_buf;
+#endif
+    char* m_base;
+    size_t m_mapLength;
+    const char* m_data;
+};
+
+//--------------------------------------------------------
+#endif
@@ -0,0 +1,73 @@
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+#include "mpi.h"
+
+//--------------------------------------------------------
+// Offset of the local MPI_Wtime against the clock of rank 0 of "comm", so
+// that rank0Time ~ MPI_Wtime() - offset. Every rank does "rounds"
+// ping-pongs with rank 0 and keeps the one with the smallest round trip,
+// assuming the reply was stamped halfway through it.
+
+double estimateClockOffset( MPI_Comm comm, int rounds )
+{
+    int rank = 0;
+    int commSize = 0;
+    MPI_Comm_rank( comm, &rank );
+    MPI_Comm_size( comm, &commSize );
+
+    const int tag = 0x5c1c;
+    MPI_Status status;
+
+    if ( rank == 0 )
+    {
+        for ( int peer = 1; peer < commSize; ++peer )
+        {
+            for ( int i = 0; i < rounds; ++i )
+            {
+                char ping = 0;
+                MPI_Recv( &ping, 1, MPI_CHAR, peer, tag, comm, &status );
+                double now = MPI_Wtime();
+                MPI_Send( &now, 1, MPI_DOUBLE, peer, tag, comm );
+            }
+        }
+        return 0.0;
+    }
+
+    double bestRtt = -1.0;
+    double offset = 0.0;
+    for ( int i = 0; i < rounds; ++i )
+    {
+        char ping = 0;
+        double remote = 0.0;
+        const double sent = MPI_Wtime();
+        MPI_Send( &ping, 1, MPI_CHAR, 0, tag, comm );
+        MPI_Recv( &remote, 1, MPI_DOUBLE, 0, tag, comm, &status );
+        const double received = MPI_Wtime();
+
+        if ( bestRtt < 0.0 || received - sent < bestRtt )
+        {
+            bestRtt = received - sent;
+            offset = 0.5 * ( sent + received ) - remote;
+        }
+    }
+
+    return offset;
+}
+
+//--------------------------------------------------------
+// Local MPI_Wtime at which all ranks should start: "lead" seconds after
+// rank 0 calls it, translated with the offset of estimateClockOffset.
+
+double synchronizedStart( MPI_Comm comm, double offset, double lead )
+{
+    int rank = 0;
+    MPI_Comm_rank( comm, &rank );
+
+    double start = rank == 0 ? MPI_Wtime() + lead : 0.0;
+    MPI_Bcast( &start, 1, MPI_DOUBLE, 0, comm );
+    return start + offset;
+}
+
+//--------------------------------------------------------
+#endif
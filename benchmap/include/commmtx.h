@@ -0,0 +1,335 @@
+#ifndef COMMMTX_H
+#define COMMMTX_H
+
+#include "mpi.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+
+#pragma warning(disable : 4996)
+
+//--------------------------------------------------------
+
+struct SMtxTriple
+{
+    int row;
+    int col;
+    double value;
+
+    bool operator<( const SMtxTriple& other ) const
+    {
+        return row < other.row || ( row == other.row && col < other.col );
+    }
+};
+
+//--------------------------------------------------------
+// Reads a matrix in the format saveCommMtx writes: "rows cols lines"
+// followed by "i j value" lines.
+
+void readMtx( const char* fileName, int& rows, int& cols, std::vector< SMtxTriple >& triples )
+{
+    if ( !fileName || !fileName[0] )
+        throw std::string( "Invalid mtx file name. " ).append( __FUNCTION__ );
+
+    FILE* fp = fopen( fileName, "rb" );
+    if ( !fp )
+        throw std::string( "Problems with mtx file. " ).append( __FUNCTION__ );
+
+    long long lines = 0;
+    if ( 3 != fscanf( fp, "%d %d %lld", &rows, &cols, &lines ) || rows <= 0 || cols <= 0 || lines < 0 )
+    {
+        fclose( fp );
+        throw std::string( "Invalid mtx header. " ).append( __FUNCTION__ );
+    }
+
+    triples.clear();
+    triples.reserve( size_t( lines ) );
+
+    SMtxTriple triple;
+    while ( 3 == fscanf( fp, "%d %d %lf", &triple.row, &triple.col, &triple.value ) )
+    {
+        if ( triple.row < 0 || triple.row >= rows || triple.col < 0 || triple.col >= cols )
+        {
+            fclose( fp );
+            throw std::string( "Mtx entry out of range. " ).append( __FUNCTION__ );
+        }
+        triples.push_back( triple );
+    }
+
+    fclose( fp );
+}
+
+//--------------------------------------------------------
+// Undirected communication graph in CSR form without self loops. saveCommMtx
+// stores the bytes of a pair in both (i, j) and (j, i), so the weight of a
+// pair is the larger of the two entries; a matrix that lists only one
+// direction gives the same result.
+
+struct SCommGraph
+{
+    int size;
+    std::vector< long long > rowPtr;
+    std::vector< int > adj;
+    std::vector< double > weights;
+
+    SCommGraph()
+        : size(0)
+    {}
+
+    long long edges() const { return (long long)adj.size() / 2; }
+};
+
+void buildCommGraph( int size, std::vector< SMtxTriple >& triples, SCommGraph& graph )
+{
+    // Fold everything into the upper triangle and merge duplicates.
+    size_t kept = 0;
+    for ( size_t i = 0; i < triples.size(); ++i )
+    {
+        SMtxTriple t = triples[i];
+        if ( t.row == t.col || t.value == 0.0 )
+            continue;
+        if ( t.row > t.col )
+            std::swap( t.row, t.col );
+        triples[ kept++ ] = t;
+    }
+    triples.resize( kept );
+    std::sort( triples.begin(), triples.end() );
+
+    kept = 0;
+    for ( size_t i = 0; i < triples.size(); ++i )
+    {
+        if ( kept > 0 && triples[ kept - 1 ].row == triples[i].row && triples[ kept - 1 ].col == triples[i].col )
+        {
+            if ( triples[i].value > triples[ kept - 1 ].value )
+                triples[ kept - 1 ].value = triples[i].value;
+        }
+        else
+            triples[ kept++ ] = triples[i];
+    }
+    triples.resize( kept );
+
+    graph.size = size;
+    graph.rowPtr.assign( size + 1, 0 );
+    for ( size_t i = 0; i < triples.size(); ++i )
+    {
+        ++graph.rowPtr[ triples[i].row + 1 ];
+        ++graph.rowPtr[ triples[i].col + 1 ];
+    }
+    for ( int i = 0; i < size; ++i )
+        graph.rowPtr[ i + 1 ] += graph.rowPtr[i];
+
+    graph.adj.resize( size_t( graph.rowPtr[ size ] ) );
+    graph.weights.resize( size_t( graph.rowPtr[ size ] ) );
+
+    std::vector< long long > fill( graph.rowPtr.begin(), graph.rowPtr.end() - 1 );
+    for ( size_t i = 0; i < triples.size(); ++i )
+    {
+        const SMtxTriple& t = triples[i];
+        graph.adj[ size_t( fill[ t.row ] ) ] = t.col;
+        graph.weights[ size_t( fill[ t.row ]++ ) ] = t.value;
+        graph.adj[ size_t( fill[ t.col ] ) ] = t.row;
+        graph.weights[ size_t( fill[ t.col ]++ ) ] = t.value;
+    }
+}
+
+void loadCommGraph( const char* fileName, SCommGraph& graph )
+{
+    int rows = 0;
+    int cols = 0;
+    std::vector< SMtxTriple > triples;
+    readMtx( fileName, rows, cols, triples );
+    if ( rows != cols )
+        throw std::string( "Comm mtx must be square. " ).append( __FUNCTION__ );
+
+    buildCommGraph( rows, triples, graph );
+}
+
+//--------------------------------------------------------
+// Accumulates a symmetric comm matrix keeping only the non-zero cells of
+// the upper triangle. Updates are appended to a log that is sorted and
+// merged into the compacted cells once it outgrows them, so memory and
+// time follow the non-zeros rather than size^2.
+
+class SparseCommMtx
+{
+public:
+    struct SCell
+    {
+        long long key;   // row * size + col, row < col
+        long long value;
+
+        bool operator<( const SCell& other ) const { return key < other.key; }
+    };
+
+    explicit SparseCommMtx( int size = 0 )
+        : m_size( size )
+    {}
+
+    int size() const { return m_size; }
+
+    void add( int i, int j, long long value )
+    {
+        if ( i == j )
+            return;
+        if ( i > j )
+            std::swap( i, j );
+
+        SCell cell;
+        cell.key = (long long)i * m_size + j;
+        cell.value = value;
+        m_log.push_back( cell );
+
+        if ( m_log.size() >= std::max( size_t( 1 << 20 ), m_cells.size() ) )
+            compact();
+    }
+
+    // Sorted, merged cells.
+    const std::vector< SCell >& cells()
+    {
+        compact();
+        return m_cells;
+    }
+
+    // Sums the matrices of all ranks of "comm" on rank 0 along a binomial
+    // tree, so no rank ever holds more than two merged matrices.
+    void reduce( MPI_Comm comm )
+    {
+        int rank = 0;
+        int commSize = 0;
+        MPI_Comm_rank( comm, &rank );
+        MPI_Comm_size( comm, &commSize );
+
+        compact();
+
+        const int tag = 0x5a7c;
+        for ( int step = 1; step < commSize; step <<= 1 )
+        {
+            if ( rank & step )
+            {
+                sendCells( comm, rank - step, tag );
+                std::vector< SCell >().swap( m_cells );
+                return;
+            }
+
+            if ( rank + step < commSize )
+            {
+                recvCells( comm, rank + step, tag, m_log );
+                compact();
+            }
+        }
+    }
+
+private:
+    void compact()
+    {
+        if ( m_log.empty() )
+            return;
+
+        std::sort( m_log.begin(), m_log.end() );
+
+        std::vector< SCell > merged;
+        merged.reserve( m_cells.size() + m_log.size() );
+
+        size_t a = 0;
+        size_t b = 0;
+        while ( a < m_cells.size() || b < m_log.size() )
+        {
+            const bool fromCells = b == m_log.size() || ( a < m_cells.size() && m_cells[a].key <= m_log[b].key );
+            const SCell& cell = fromCells ? m_cells[ a++ ] : m_log[ b++ ];
+            if ( !merged.empty() && merged.back().key == cell.key )
+                merged.back().value += cell.value;
+            else
+                merged.push_back( cell );
+        }
+
+        m_cells.swap( merged );
+        m_log.clear();
+    }
+
+    void sendCells( MPI_Comm comm, int peer, int tag )
+    {
+        long long count = (long long)m_cells.size();
+        MPI_Send( &count, 1, MPI_LONG_LONG, peer, tag, comm );
+
+        const long long chunk = 1 << 26;
+        for ( long long begin = 0; begin < count; begin += chunk )
+        {
+            const int len = int( std::min( chunk, count - begin ) );
+            MPI_Send( &m_cells[ size_t( begin ) ], 2 * len, MPI_LONG_LONG, peer, tag, comm );
+        }
+    }
+
+    static void recvCells( MPI_Comm comm, int peer, int tag, std::vector< SCell >& cells )
+    {
+        long long count = 0;
+        MPI_Recv( &count, 1, MPI_LONG_LONG, peer, tag, comm, MPI_STATUS_IGNORE );
+        cells.resize( size_t( count ) );
+
+        const long long chunk = 1 << 26;
+        for ( long long begin = 0; begin < count; begin += chunk )
+        {
+            const int len = int( std::min( chunk, count - begin ) );
+            MPI_Recv( &cells[ size_t( begin ) ], 2 * len, MPI_LONG_LONG, peer, tag, comm, MPI_STATUS_IGNORE );
+        }
+    }
+
+private:
+    int m_size;
+    std::vector< SCell > m_cells;
+    std::vector< SCell > m_log;
+};
+
+//--------------------------------------------------------
+// Writes both directions of every cell, row by row, in the format readMtx
+// reads. The cells below the diagonal of a row are found through a
+// transposed index, so the file is streamed in one pass.
+
+void saveCommMtx( SparseCommMtx& mtx, const char* fileName )
+{
+    const std::vector< SparseCommMtx::SCell >& cells = mtx.cells();
+    const int size = mtx.size();
+
+    std::vector< long long > colPtr( size + 1, 0 );
+    for ( size_t c = 0; c < cells.size(); ++c )
+        ++colPtr[ cells[c].key % size + 1 ];
+    for ( int i = 0; i < size; ++i )
+        colPtr[ i + 1 ] += colPtr[i];
+
+    // Cells are sorted by row, so every column lists its rows in order.
+    std::vector< size_t > byCol( cells.size() );
+    std::vector< long long > fill( colPtr.begin(), colPtr.end() - 1 );
+    for ( size_t c = 0; c < cells.size(); ++c )
+        byCol[ size_t( fill[ cells[c].key % size ]++ ) ] = c;
+
+    FILE* fp = fopen( fileName, "wb" );
+    if ( !fp ) 
+        throw std::string( "Problems with comm mtx file. " ).append( __FUNCTION__ );
+
+    std::vector< char > buffer( 1 << 22 );
+    setvbuf( fp, &buffer[0], _IOFBF, buffer.size() );
+
+    fprintf( fp, "%d %d %lld\n", size, size, 2 * (long long)cells.size() );
+
+    size_t next = 0;
+    for ( int i = 0; i < size; ++i )
+    {
+        for ( long long c = colPtr[i]; c < colPtr[ i + 1 ]; ++c )
+        {
+            const SparseCommMtx::SCell& cell = cells[ byCol[ size_t( c ) ] ];
+            fprintf( fp, "%d %lld %lld\n", i, cell.key / size, cell.value );
+        }
+        for ( ; next < cells.size() && cells[ next ].key / size == i; ++next )
+            fprintf( fp, "%d %lld %lld\n", i, cells[ next ].key % size, cells[ next ].value );
+    }
+
+    const bool failed = ferror( fp ) != 0;
+    fclose( fp );
+    if ( failed )
+        throw std::string( "Error while comm mtx writing. " ).append( __FUNCTION__ );
+}
+
+//--------------------------------------------------------
+#endif
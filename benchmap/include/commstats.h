@@ -0,0 +1,143 @@
+#ifndef COMMSTATS_H
+#define COMMSTATS_H
+
+#include "mpi.h"
+
+#include <map>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+
+#pragma warning(disable : 4996)
+
+//--------------------------------------------------------
+
+struct SPeerStats
+{
+    long long bytes;
+    long long count;
+    double time;
+
+    SPeerStats()
+        : bytes(0)
+        , count(0)
+        , time(0.0)
+    {}
+};
+
+struct SMtxEntry
+{
+    int row;
+    int col;
+    long long bytes;
+    long long count;
+    double time;
+};
+
+//--------------------------------------------------------
+// Bytes, messages and time a rank actually exchanged with each of its
+// peers during replay. Only peers the rank talked to are stored.
+
+class PeerStats
+{
+public:
+    void add( int peer, int size, double seconds )
+    {
+        SPeerStats& stats = m_peers[ peer ];
+        stats.bytes += size;
+        ++stats.count;
+        stats.time += seconds;
+    }
+
+    // Gathers the non-zero entries of all ranks on rank 0 and writes them
+    // in the "i j value" format of saveCommMtx. "metric" is one of "bw"
+    // (bytes per second), "lat" (average microseconds per message),
+    // "bytes" or "count".
+    void save( MPI_Comm comm, const char* fileName, const std::string& metric ) const
+    {
+        int rank = 0;
+        int commSize = 0;
+        MPI_Comm_rank( comm, &rank );
+        MPI_Comm_size( comm, &commSize );
+
+        std::vector< SMtxEntry > local;
+        local.reserve( m_peers.size() );
+        for ( std::map< int, SPeerStats >::const_iterator it = m_peers.begin(); it != m_peers.end(); ++it )
+        {
+            SMtxEntry entry;
+            entry.row   = rank;
+            entry.col   = it->first;
+            entry.bytes = it->second.bytes;
+            entry.count = it->second.count;
+            entry.time  = it->second.time;
+            local.push_back( entry );
+        }
+
+        MPI_Datatype entryType;
+        MPI_Type_contiguous( sizeof(SMtxEntry), MPI_BYTE, &entryType );
+        MPI_Type_commit( &entryType );
+
+        int localNum = int( local.size() );
+        std::vector< int > counts( commSize );
+        std::vector< int > displs( commSize );
+        MPI_Gather( &localNum, 1, MPI_INT, &counts[0], 1, MPI_INT, 0, comm );
+
+        int total = 0;
+        for ( int i = 0; i < commSize; ++i )
+        {
+            displs[i] = total;
+            total += counts[i];
+        }
+
+        std::vector< SMtxEntry > entries( rank == 0 ? total : 0 );
+        MPI_Gatherv( local.empty() ? 0 : &local[0], localNum, entryType,
+                     entries.empty() ? 0 : &entries[0], &counts[0], &displs[0], entryType, 0, comm );
+        MPI_Type_free( &entryType );
+
+        if ( rank != 0 )
+            return;
+
+        std::stringstream outData;
+        for ( size_t i = 0; i < entries.size(); ++i )
+        {
+            const SMtxEntry& entry = entries[i];
+            outData << entry.row << " " << entry.col << " ";
+
+            if ( metric == "bytes" )
+                outData << entry.bytes;
+            else if ( metric == "count" )
+                outData << entry.count;
+            else if ( metric == "lat" )
+                outData << ( entry.count > 0 ? entry.time / entry.count * 1e6 : 0.0 );
+            else
+                outData << ( entry.time > 0.0 ? entry.bytes / entry.time : 0.0 );
+
+            outData << "\n";
+        }
+
+        FILE* fp = fopen( fileName, "wb" );
+        if ( !fp )
+            throw std::string( "Problems with measured mtx file. " ).append( __FUNCTION__ );
+
+        std::stringstream desc;
+        desc << commSize << " " << commSize << " " << entries.size() << "\n";
+
+        size_t res = fwrite( desc.str().c_str(), 1, desc.str().length(), fp );
+        if ( res != desc.str().length() )
+            throw std::string( "Error while measured mtx writing. " ).append( __FUNCTION__ );
+
+        res = fwrite( outData.str().c_str(), 1, outData.str().length(), fp );
+        if ( res != outData.str().length() )
+            throw std::string( "Error while measured mtx writing. " ).append( __FUNCTION__ );
+
+        fclose( fp );
+    }
+
+private:
+    std::map< int, SPeerStats > m_peers;
+};
+
+//--------------------------------------------------------
+#endif
@@ -0,0 +1,214 @@
+#ifndef CONVERTER_H
+#define CONVERTER_H
+
+#include "parparser.h"
+#include "trace.h"
+#include "bintrace.h"
+#include "mpi.h"
+
+#include <string>
+#include <iostream>
+#include <vector>
+#include <stdio.h>
+
+#pragma warning(disable : 4996)
+
+//--------------------------------------------------------
+// Reads the text trace "in" block by block and parses the records after
+// its header, one block of whole lines at a time.
+
+class TextTraceReader
+{
+public:
+    explicit TextTraceReader( FILE* in )
+        : m_in( in )
+        , m_block( BLOCK_SIZE )
+        , m_eof( false )
+    {}
+
+    // Reads from the start of the file up to the first record.
+    bool start( STraceHeader& header )
+    {
+        rewind( m_in );
+        m_data.clear();
+        m_eof = false;
+
+        bool headerFound = false;
+        while ( !headerFound && !m_eof )
+        {
+            read();
+            headerFound = parseTraceHeader( m_data.c_str(), m_data.size(), header );
+        }
+        if ( !headerFound )
+            return false;
+
+        m_data.erase( 0, size_t( header.dataOffset ) );
+        return true;
+    }
+
+    // False once all records were returned.
+    bool next( std::vector< STraceRecord >& records )
+    {
+        if ( m_eof && m_data.empty() )
+            return false;
+
+        size_t parseLength = m_data.size();
+        if ( !m_eof )
+        {
+            const size_t lastLine = m_data.rfind( '\n' );
+            parseLength = lastLine == std::string::npos ? 0 : lastLine + 1;
+        }
+
+        records.clear();
+        parseTraceLines( m_data.c_str(), 0, 0, MPI_Offset( parseLength ), MPI_Offset( parseLength ), true, records );
+        m_data.erase( 0, parseLength );
+
+        if ( !m_eof )
+            read();
+        return true;
+    }
+
+private:
+    enum { BLOCK_SIZE = 16 * 1024 * 1024 };
+
+    void read()
+    {
+        const size_t res = fread( &m_block[0], 1, m_block.size(), m_in );
+        m_data.append( &m_block[0], res );
+        m_eof = res < m_block.size();
+    }
+
+private:
+    FILE* m_in;
+    std::vector< char > m_block;
+    std::string m_data;
+    bool m_eof;
+};
+
+//--------------------------------------------------------
+// Writes "count" items of "size" bytes to "out"; on a short write closes
+// both files and throws.
+
+void writeTraceData( const void* data, size_t size, size_t count, FILE* in, FILE* out )
+{
+    if ( count != fwrite( data, size, count, out ) )
+    {
+        fclose( in );
+        fclose( out );
+        throw std::string( "Error while out file writing. " ).append( __FUNCTION__ );
+    }
+}
+
+//--------------------------------------------------------
+// Converts a text trace into the binary format block by block, so the
+// whole trace never has to fit in memory. A first pass only finds out
+// whether the records have delays or timestamps, so the records written
+// by the second are no wider than needed.
+
+void convertTextTrace( const char* inFile, const char* outFile )
+{
+    FILE* in = fopen( inFile, "rb" );
+    if ( !in )
+        throw std::string( "Problems with input trace file. " ).append( __FUNCTION__ );
+
+    FILE* out = fopen( outFile, "wb" );
+    if ( !out )
+    {
+        fclose( in );
+        throw std::string( "Problems with output trace file. " ).append( __FUNCTION__ );
+    }
+
+    TextTraceReader reader( in );
+    STraceHeader header;
+    if ( !reader.start( header ) )
+    {
+        fclose( in );
+        fclose( out );
+        throw std::string( "Invalid trace header. " ).append( __FUNCTION__ );
+    }
+
+    std::vector< STraceRecord > records;
+    bool delays = false;
+    bool times = false;
+    while ( reader.next( records ) )
+    {
+        for ( size_t i = 0; i < records.size(); ++i )
+        {
+            delays = delays || records[i].delay >= 0;
+            times = times || records[i].time >= 0.0;
+        }
+    }
+    reader.start( header );
+
+    SBinTraceHeader binHeader;
+    initBinTraceHeader( binHeader );
+    binHeader.recordSize = binRecordSize( delays, times );
+    binHeader.procsNum  = header.procsNum;
+    binHeader.bufSize   = header.bufSize;
+    binHeader.sleepTime = header.sleepTime;
+    binHeader.sleepUs   = header.sleepUs;
+    binHeader.delayMode = header.delayMode;
+
+    std::vector< int > commTable;
+    header.packComms( commTable );
+    binHeader.commTableInts = int( commTable.size() );
+
+    writeTraceData( &binHeader, sizeof(binHeader), 1, in, out );
+    if ( !commTable.empty() )
+        writeTraceData( &commTable[0], sizeof(int), commTable.size(), in, out );
+
+    std::string binData;
+    while ( reader.next( records ) )
+    {
+        binData.clear();
+        for ( size_t i = 0; i < records.size(); ++i )
+        {
+            const STraceRecord& rec = records[i];
+            appendBinRecord( binData, binHeader.recordSize, rec.kind, rec.from, rec.to, rec.size, rec.delay, rec.time );
+            binHeader.transfered += recordVolume( rec, header );
+        }
+        binHeader.recordsNum += records.size();
+
+        writeTraceData( binData.c_str(), 1, binData.size(), in, out );
+    }
+
+    rewind( out );
+    writeTraceData( &binHeader, sizeof(binHeader), 1, in, out );
+
+    // Buffered data reaches the disk only here.
+    fclose( in );
+    if ( 0 != fclose( out ) )
+        throw std::string( "Error while out file writing. " ).append( __FUNCTION__ );
+
+    std::cout << "records: " << binHeader.recordsNum << "\n";
+}
+
+//--------------------------------------------------------
+
+int converter_routine( parparser& args )
+{
+    int rank = 0;
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    if ( rank != 0 )
+        return 0;
+
+    try
+    {
+        const char* inFile = args.get( "t" ).asString(0);
+        const char* outFile = args.get( "o" ).asString(0);
+        if ( !inFile || !inFile[0] || !outFile || !outFile[0] )
+            throw std::string( "Invalid trace file names. " ).append( __FUNCTION__ );
+
+        convertTextTrace( inFile, outFile );
+    }
+    catch( std::string err )
+    {
+        std::cerr << "ERROR OCCURED:\n    " << err << "\n";
+        std::cerr.flush();
+    }
+
+    return 0;
+}
+
+//--------------------------------------------------------
+#endif
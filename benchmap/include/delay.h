@@ -0,0 +1,241 @@
+#ifndef DELAY_H
+#define DELAY_H
+
+#include "mpi.h"
+
+#include <string>
+#include <vector>
+#include <string.h>
+
+#ifdef _MSC_VER
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <Windows.h>
+#else
+    #include <time.h>
+    #include <unistd.h>
+#endif
+
+//--------------------------------------------------------
+
+enum EDelayMode
+{
+    DELAY_SLEEP  = 0,   // usleep/Sleep, the historical behaviour
+    DELAY_SPIN   = 1,   // busy-wait on the wall clock
+    DELAY_HYBRID = 2,   // OS sleep for the bulk, spin for the tail
+    DELAY_FLOPS  = 3,   // calibrated register-resident arithmetic
+    DELAY_MEMBW  = 4    // calibrated streaming triad over a large array
+};
+
+//--------------------------------------------------------
+
+int parseDelayMode( const char* name )
+{
+    if ( !name || !name[0] )
+        return -1;
+    if ( 0 == strcmp( "sleep", name ) )
+        return DELAY_SLEEP;
+    if ( 0 == strcmp( "spin", name ) )
+        return DELAY_SPIN;
+    if ( 0 == strcmp( "hybrid", name ) )
+        return DELAY_HYBRID;
+    if ( 0 == strcmp( "flops", name ) )
+        return DELAY_FLOPS;
+    if ( 0 == strcmp( "membw", name ) )
+        return DELAY_MEMBW;
+    return -1;
+}
+
+const char* delayModeName( int mode )
+{
+    switch ( mode )
+    {
+    case DELAY_SPIN:   return "spin";
+    case DELAY_HYBRID: return "hybrid";
+    case DELAY_FLOPS:  return "flops";
+    case DELAY_MEMBW:  return "membw";
+    default:           return "sleep";
+    }
+}
+
+//--------------------------------------------------------
+// Emulates compute gaps of the given length in microseconds. The compute
+// modes are calibrated once at construction, so a delay burns the amount
+// of real work this core does in that time rather than idling.
+
+class DelayEngine
+{
+public:
+    explicit DelayEngine( int mode )
+        : m_mode( mode )
+        , m_sleepSlack( 0.0 )
+        , m_unitsPerUs( 0.0 )
+        , m_membwPos( 0 )
+        , m_sink( 0.0 )
+    {
+        if ( m_mode == DELAY_HYBRID )
+            calibrateSleep();
+        else if ( m_mode == DELAY_FLOPS || m_mode == DELAY_MEMBW )
+            calibrateCompute();
+    }
+
+    int mode() const { return m_mode; }
+
+    // False for the compute modes, whose delays are amounts of work.
+    bool timeBased() const { return m_mode != DELAY_FLOPS && m_mode != DELAY_MEMBW; }
+
+    void wait( int us )
+    {
+        if ( us <= 0 )
+            return;
+
+        switch ( m_mode )
+        {
+        case DELAY_SPIN:
+            spinUntil( MPI_Wtime() + us * 1e-6 );
+            break;
+        case DELAY_HYBRID:
+            waitUntil( MPI_Wtime() + us * 1e-6 );
+            break;
+        case DELAY_FLOPS:
+        case DELAY_MEMBW:
+            runUnits( (long long)( us * m_unitsPerUs + 0.5 ) );
+            break;
+        default:
+        #ifdef _MSC_VER
+            Sleep( ( us + 999 ) / 1000 );
+        #else
+            usleep( us );
+        #endif
+            break;
+        }
+    }
+
+    // Sleeps for the bulk of the interval and spins over the last
+    // "m_sleepSlack" seconds, which covers the OS wake-up jitter.
+    void waitUntil( double deadline )
+    {
+        const double remaining = deadline - MPI_Wtime();
+        if ( remaining > m_sleepSlack )
+            osSleep( remaining - m_sleepSlack );
+        spinUntil( deadline );
+    }
+
+    static void spinUntil( double deadline )
+    {
+        while ( MPI_Wtime() < deadline )
+            ;
+    }
+
+private:
+    static void osSleep( double seconds )
+    {
+    #ifdef _MSC_VER
+        Sleep( DWORD( seconds * 1000 ) );
+    #else
+        timespec ts;
+        ts.tv_sec = time_t( seconds );
+        ts.tv_nsec = long( ( seconds - double( ts.tv_sec ) ) * 1e9 );
+        nanosleep( &ts, 0 );
+    #endif
+    }
+
+    void calibrateSleep()
+    {
+    #ifdef _MSC_VER
+        m_sleepSlack = 2e-3;
+    #else
+        double worst = 0.0;
+        for ( int i = 0; i < 20; ++i )
+        {
+            const double start = MPI_Wtime();
+            osSleep( 1e-6 );
+            const double overshoot = MPI_Wtime() - start;
+            if ( overshoot > worst )
+                worst = overshoot;
+        }
+        m_sleepSlack = 2.0 * worst;
+    #endif
+    }
+
+    void calibrateCompute()
+    {
+        if ( m_mode == DELAY_MEMBW )
+        {
+            const size_t elements = 2 * 1024 * 1024;
+            m_a.assign( elements, 1.0 );
+            m_b.assign( elements, 2.0 );
+            m_c.assign( elements, 0.0 );
+        }
+
+        runUnits( 64 );
+
+        long long units = 64;
+        double elapsed = 0.0;
+        while ( true )
+        {
+            const double start = MPI_Wtime();
+            runUnits( units );
+            elapsed = MPI_Wtime() - start;
+            if ( elapsed > 0.02 )
+                break;
+            units *= 2;
+        }
+
+        m_unitsPerUs = units / ( elapsed * 1e6 );
+    }
+
+    void runUnits( long long units )
+    {
+        if ( m_mode == DELAY_MEMBW )
+        {
+            const size_t unitSize = 4096;
+            const size_t elements = m_a.size();
+            for ( long long u = 0; u < units; ++u )
+            {
+                double* a = &m_a[ m_membwPos ];
+                const double* b = &m_b[ m_membwPos ];
+                const double* c = &m_c[ m_membwPos ];
+                for ( size_t i = 0; i < unitSize; ++i )
+                    a[i] = b[i] + 3.0 * c[i];
+
+                m_membwPos += unitSize;
+                if ( m_membwPos + unitSize > elements )
+                    m_membwPos = 0;
+            }
+            m_sink += m_a[0];
+        }
+        else
+        {
+            double x0 = 1.0, x1 = 1.1, x2 = 1.2, x3 = 1.3;
+            const double mul = 0.999999, add = 1e-7;
+            for ( long long u = 0; u < units; ++u )
+            {
+                for ( int i = 0; i < 64; ++i )
+                {
+                    x0 = x0 * mul + add;
+                    x1 = x1 * mul + add;
+                    x2 = x2 * mul + add;
+                    x3 = x3 * mul + add;
+                }
+            }
+            m_sink += x0 + x1 + x2 + x3;
+        }
+    }
+
+private:
+    int m_mode;
+    double m_sleepSlack;
+    double m_unitsPerUs;
+
+    std::vector< double > m_a;
+    std::vector< double > m_b;
+    std::vector< double > m_c;
+    size_t m_membwPos;
+
+    volatile double m_sink;
+};
+
+//--------------------------------------------------------
+#endif
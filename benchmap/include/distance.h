@@ -0,0 +1,139 @@
+#ifndef DISTANCE_H
+#define DISTANCE_H
+
+#include "commmtx.h"
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+//--------------------------------------------------------
+// Distance between two cores of the machine. Either a dense matrix read
+// from an "i j distance" file, or a hierarchy given as
+// "arity:cost,arity:cost,..." from the outermost level inwards, e.g.
+// "16:10,2:3,8:1" for 16 nodes of 2 sockets of 8 cores, where cores on
+// different nodes are 10 apart, on different sockets 3 and on the same
+// socket 1. The hierarchy needs no storage, so it scales to any size.
+// A distance file holds either form: a hierarchy on its first line, or
+// the matrix.
+
+class DistanceModel
+{
+public:
+    DistanceModel()
+        : m_cores(0)
+    {}
+
+    int cores() const { return m_cores; }
+    bool hierarchical() const { return !m_arity.empty(); }
+
+    // Number of levels and the cost of crossing each of them; a dense
+    // matrix is treated as a single level.
+    int levels() const { return hierarchical() ? int( m_arity.size() ) : 1; }
+    long long levelStride( int level ) const { return hierarchical() ? m_stride[ level ] : 1; }
+    double levelCost( int level ) const { return hierarchical() ? m_cost[ level ] : 1.0; }
+
+    void parseLevels( const char* spec )
+    {
+        m_arity.clear();
+        m_cost.clear();
+        m_matrix.clear();
+
+        const char* cur = spec;
+        while ( cur && *cur )
+        {
+            char* next = 0;
+            const int arity = strtol( cur, &next, 10 );
+            if ( next == cur || *next != ':' || arity <= 0 )
+                throw std::string( "Invalid topology levels. " ).append( __FUNCTION__ );
+
+            cur = next + 1;
+            const double cost = strtod( cur, &next );
+            if ( next == cur )
+                throw std::string( "Invalid topology levels. " ).append( __FUNCTION__ );
+
+            m_arity.push_back( arity );
+            m_cost.push_back( cost );
+            cur = *next == ',' ? next + 1 : next;
+        }
+
+        if ( m_arity.empty() )
+            throw std::string( "Invalid topology levels. " ).append( __FUNCTION__ );
+
+        m_stride.assign( m_arity.size(), 1 );
+        for ( int l = int( m_arity.size() ) - 2; l >= 0; --l )
+            m_stride[l] = m_stride[ l + 1 ] * m_arity[ l + 1 ];
+
+        const long long cores = m_stride[0] * m_arity[0];
+        if ( cores > 0x7fffffff )
+            throw std::string( "Too many cores. " ).append( __FUNCTION__ );
+        m_cores = int( cores );
+    }
+
+    // Reads a distance file written by the topology discovery, or a
+    // distance matrix.
+    void load( const char* fileName )
+    {
+        FILE* fp = fopen( fileName, "rb" );
+        if ( !fp )
+            throw std::string( "Problems with distance file. " ).append( __FUNCTION__ );
+
+        char line[1024];
+        const bool read = 0 != fgets( line, sizeof(line), fp );
+        fclose( fp );
+        if ( !read || !strchr( line, ':' ) )
+        {
+            loadMatrix( fileName );
+            return;
+        }
+
+        size_t len = strlen( line );
+        while ( len > 0 && ( line[ len - 1 ] == '\n' || line[ len - 1 ] == '\r' || line[ len - 1 ] == ' ' ) )
+            line[ --len ] = 0;
+        parseLevels( line );
+    }
+
+    void loadMatrix( const char* fileName )
+    {
+        int rows = 0;
+        int cols = 0;
+        std::vector< SMtxTriple > triples;
+        readMtx( fileName, rows, cols, triples );
+        if ( rows != cols )
+            throw std::string( "Distance mtx must be square. " ).append( __FUNCTION__ );
+
+        m_arity.clear();
+        m_cost.clear();
+        m_stride.clear();
+        m_cores = rows;
+        m_matrix.assign( size_t( rows ) * rows, 0.0f );
+        for ( size_t i = 0; i < triples.size(); ++i )
+            m_matrix[ size_t( triples[i].row ) * rows + triples[i].col ] = float( triples[i].value );
+    }
+
+    double operator()( int a, int b ) const
+    {
+        if ( a == b )
+            return 0.0;
+
+        if ( !hierarchical() )
+            return m_matrix[ size_t( a ) * m_cores + b ];
+
+        for ( size_t l = 0; l < m_stride.size(); ++l )
+            if ( a / m_stride[l] != b / m_stride[l] )
+                return m_cost[l];
+        return 0.0;
+    }
+
+private:
+    int m_cores;
+    std::vector< int > m_arity;
+    std::vector< long long > m_stride;
+    std::vector< double > m_cost;
+    std::vector< float > m_matrix;
+};
+
+//--------------------------------------------------------
+#endif
@@ -0,0 +1,382 @@
+#ifndef EVALUATOR_H
+#define EVALUATOR_H
+
+#include "commmtx.h"
+#include "distance.h"
+#include "mapping.h"
+#include "parparser.h"
+#include "rng.h"
+#include "mpi.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <sstream>
+#include <algorithm>
+
+#ifdef _MSC_VER
+    #ifndef NOMINMAX
+        #define NOMINMAX
+    #endif
+    #include <windows.h>
+    #include <process.h>
+#else
+    #include <pthread.h>
+    #include <unistd.h>
+#endif
+
+//--------------------------------------------------------
+// LogGP parameters in microseconds (G per byte). Latency and per-byte
+// cost grow with the distance between the cores, overheads do not.
+
+struct SLogGP
+{
+    double L;
+    double o;
+    double g;
+    double G;
+
+    SLogGP()
+        : L( 1.0 )
+        , o( 0.5 )
+        , g( 0.5 )
+        , G( 1e-4 )
+    {}
+
+    // "L,o,g,G"
+    void parse( const char* spec )
+    {
+        if ( 4 != sscanf( spec, "%lf,%lf,%lf,%lf", &L, &o, &g, &G ) )
+            throw std::string( "Invalid LogGP parameters. " ).append( __FUNCTION__ );
+    }
+};
+
+struct SMappingCost
+{
+    double hopBytes;
+    double maxLinkLoad;
+    double time;
+
+    SMappingCost()
+        : hopBytes( 0.0 )
+        , maxLinkLoad( 0.0 )
+        , time( 0.0 )
+    {}
+};
+
+//--------------------------------------------------------
+// Scores a mapping against a comm graph without running anything.
+//
+// Links: in a hierarchical model every group of every level has one
+// uplink (a core's own link at the innermost level), and a message
+// between two cores loads the uplinks of all groups below their common
+// ancestor. A distance matrix does not describe links, so only the core
+// injection links are counted there.
+//
+// Time: every pair is taken as one message, so rank i needs
+// sum_j ( max(o, g) + o + d_ij * ( L + ( w_ij - 1 ) * G ) ). The
+// predicted time is the slowest rank, or the busiest link if it needs
+// longer to carry its bytes at G.
+
+class MappingEvaluator
+{
+public:
+    MappingEvaluator( const SCommGraph& graph, const DistanceModel& dist, const SLogGP& params )
+        : m_graph( graph )
+        , m_dist( dist )
+        , m_params( params )
+    {
+        int links = 0;
+        for ( int l = 0; l < levels(); ++l )
+        {
+            m_linkOffsets.push_back( links );
+            links += int( m_dist.cores() / stride(l) );
+        }
+        m_links = links;
+    }
+
+    int links() const { return m_links; }
+
+    // "linkLoad" is scratch space, so that threads do not share it.
+    void evaluate( const std::vector< int >& mapping, SMappingCost& cost, std::vector< double >& linkLoad ) const
+    {
+        linkLoad.assign( m_links, 0.0 );
+        cost = SMappingCost();
+
+        double slowest = 0.0;
+        for ( int u = 0; u < m_graph.size; ++u )
+        {
+            const int cu = mapping[u];
+            double rankTime = 0.0;
+            for ( long long e = m_graph.rowPtr[u]; e < m_graph.rowPtr[ u + 1 ]; ++e )
+            {
+                const int v = m_graph.adj[ size_t( e ) ];
+                const int cv = mapping[v];
+                const double w = m_graph.weights[ size_t( e ) ];
+                const double d = m_dist( cu, cv );
+
+                rankTime += std::max( m_params.o, m_params.g ) + m_params.o + d * ( m_params.L + ( w > 1.0 ? w - 1.0 : 0.0 ) * m_params.G );
+
+                if ( v < u || cu == cv )
+                    continue;
+
+                cost.hopBytes += w * d;
+
+                // Uplinks of both sides from the first level they differ at.
+                int level = 0;
+                while ( level < levels() && cu / stride( level ) == cv / stride( level ) )
+                    ++level;
+                for ( ; level < levels(); ++level )
+                {
+                    linkLoad[ m_linkOffsets[ level ] + int( cu / stride( level ) ) ] += w;
+                    linkLoad[ m_linkOffsets[ level ] + int( cv / stride( level ) ) ] += w;
+                }
+            }
+
+            if ( rankTime > slowest )
+                slowest = rankTime;
+        }
+
+        for ( int i = 0; i < m_links; ++i )
+            if ( linkLoad[i] > cost.maxLinkLoad )
+                cost.maxLinkLoad = linkLoad[i];
+
+        cost.time = std::max( slowest, cost.maxLinkLoad * m_params.G );
+    }
+
+private:
+    // A distance matrix has the core links as its only level.
+    int levels() const { return m_dist.hierarchical() ? m_dist.levels() : 1; }
+    long long stride( int level ) const { return m_dist.levelStride( level ); }
+
+private:
+    const SCommGraph& m_graph;
+    const DistanceModel& m_dist;
+    SLogGP m_params;
+    std::vector< int > m_linkOffsets;
+    int m_links;
+};
+
+//--------------------------------------------------------
+// Candidates "first", "first + step", ... of one worker thread.
+
+struct SEvaluatorWork
+{
+    const MappingEvaluator* evaluator;
+    const std::vector< std::vector< int > >* mappings;
+    std::vector< SMappingCost >* costs;
+    size_t first;
+    size_t step;
+
+    void run() const
+    {
+        std::vector< double > linkLoad;
+        for ( size_t i = first; i < mappings->size(); i += step )
+            evaluator->evaluate( ( *mappings )[i], ( *costs )[i], linkLoad );
+    }
+};
+
+#ifdef _MSC_VER
+unsigned __stdcall evaluatorThread( void* work )
+{
+    static_cast< SEvaluatorWork* >( work )->run();
+    return 0;
+}
+#else
+void* evaluatorThread( void* work )
+{
+    static_cast< SEvaluatorWork* >( work )->run();
+    return 0;
+}
+#endif
+
+int onlineCores()
+{
+#ifdef _MSC_VER
+    SYSTEM_INFO info;
+    GetSystemInfo( &info );
+    return int( info.dwNumberOfProcessors );
+#else
+    return int( sysconf( _SC_NPROCESSORS_ONLN ) );
+#endif
+}
+
+//--------------------------------------------------------
+// Scores all candidates on "threads" threads; candidate i goes to thread
+// i % threads.
+
+void evaluateMappings( const MappingEvaluator& evaluator, const std::vector< std::vector< int > >& mappings,
+                       std::vector< SMappingCost >& costs, int threads )
+{
+    costs.resize( mappings.size() );
+
+    std::vector< SEvaluatorWork > work( threads > 1 ? threads : 1 );
+    for ( size_t t = 0; t < work.size(); ++t )
+    {
+        work[t].evaluator = &evaluator;
+        work[t].mappings = &mappings;
+        work[t].costs = &costs;
+        work[t].first = t;
+        work[t].step = work.size();
+    }
+
+    if ( work.size() == 1 )
+    {
+        work[0].run();
+        return;
+    }
+
+#ifdef _MSC_VER
+    std::vector< HANDLE > workers( work.size() );
+    for ( size_t t = 0; t < work.size(); ++t )
+        workers[t] = (HANDLE)_beginthreadex( 0, 0, &evaluatorThread, &work[t], 0, 0 );
+    for ( size_t t = 0; t < workers.size(); ++t )
+    {
+        WaitForSingleObject( workers[t], INFINITE );
+        CloseHandle( workers[t] );
+    }
+#else
+    std::vector< pthread_t > workers( work.size() );
+    for ( size_t t = 0; t < work.size(); ++t )
+        pthread_create( &workers[t], 0, &evaluatorThread, &work[t] );
+    for ( size_t t = 0; t < workers.size(); ++t )
+        pthread_join( workers[t], 0 );
+#endif
+}
+
+//--------------------------------------------------------
+
+void printMappingCost( std::ostream& out, const std::string& name, const SMappingCost& cost )
+{
+    out << name << ": hop-bytes " << cost.hopBytes << ", max link " << cost.maxLinkLoad << ", time " << cost.time << " us\n";
+}
+
+//--------------------------------------------------------
+// Offline mode: scores the identity mapping, the mappings listed in
+// -maps (comma separated files) and -random N random placements.
+
+int evaluator_routine( parparser& args )
+{
+    int rank = 0;
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    if ( rank != 0 )
+        return 0;
+
+    try
+    {
+        SCommGraph graph;
+        loadCommGraph( args.get( "mtx" ).asString(0), graph );
+
+        DistanceModel dist;
+        loadDistanceModel( args, dist );
+        if ( dist.cores() < graph.size )
+            throw std::string( "Topology has fewer cores than ranks. " ).append( __FUNCTION__ );
+
+        SLogGP params;
+        const char* loggp = args.get( "loggp" ).asString(0);
+        if ( loggp && loggp[0] )
+            params.parse( loggp );
+
+        int threads = args.get( "threads" ).asInt( onlineCores() );
+        if ( threads <= 0 )
+            threads = 1;
+
+        std::vector< std::vector< int > > mappings;
+        std::vector< std::string > names;
+
+        mappings.push_back( std::vector< int >( graph.size ) );
+        for ( int i = 0; i < graph.size; ++i )
+            mappings.back()[i] = i;
+        names.push_back( "identity" );
+
+        std::stringstream files( args.get( "maps" ).asString( "" ) );
+        std::string file;
+        while ( std::getline( files, file, ',' ) )
+        {
+            if ( file.empty() )
+                continue;
+            mappings.push_back( std::vector< int >() );
+            readMapping( file.c_str(), mappings.back() );
+            if ( int( mappings.back().size() ) != graph.size )
+                throw std::string( "Mapping does not match the comm mtx. " ).append( __FUNCTION__ );
+            for ( int i = 0; i < graph.size; ++i )
+                if ( mappings.back()[i] >= dist.cores() )
+                    throw std::string( "Mapping does not fit the topology. " ).append( __FUNCTION__ );
+            names.push_back( file );
+        }
+
+        MappingEvaluator evaluator( graph, dist, params );
+        std::vector< SMappingCost > costs;
+        double start = MPI_Wtime();
+        evaluateMappings( evaluator, mappings, costs, threads );
+        double elapsed = MPI_Wtime() - start;
+        size_t evaluated = mappings.size();
+
+        for ( size_t i = 0; i < mappings.size(); ++i )
+            printMappingCost( std::cout, names[i], costs[i] );
+
+        // Random placements are scored in batches, so that only one batch
+        // is kept in memory.
+        const int randomNum = args.get( "random" ).asInt( 0 );
+        if ( randomNum > 0 )
+        {
+            Rng rng( uint64_t( args.get( "seed" ).asInt( 1 ) ) );
+            std::vector< int > cores( dist.cores() );
+            for ( int i = 0; i < dist.cores(); ++i )
+                cores[i] = i;
+
+            const int batchSize = 64 * threads;
+            std::vector< int > best;
+            SMappingCost bestCost;
+            SMappingCost mean;
+            for ( int done = 0; done < randomNum; done += batchSize )
+            {
+                const int batch = std::min( batchSize, randomNum - done );
+                mappings.resize( batch );
+                for ( int i = 0; i < batch; ++i )
+                {
+                    for ( size_t c = cores.size() - 1; c > 0; --c )
+                        std::swap( cores[c], cores[ size_t( rng.below( c + 1 ) ) ] );
+                    mappings[i].assign( cores.begin(), cores.begin() + graph.size );
+                }
+
+                start = MPI_Wtime();
+                evaluateMappings( evaluator, mappings, costs, threads );
+                elapsed += MPI_Wtime() - start;
+                evaluated += batch;
+
+                for ( int i = 0; i < batch; ++i )
+                {
+                    if ( best.empty() || costs[i].time < bestCost.time )
+                    {
+                        best = mappings[i];
+                        bestCost = costs[i];
+                    }
+                    mean.hopBytes += costs[i].hopBytes / randomNum;
+                    mean.maxLinkLoad += costs[i].maxLinkLoad / randomNum;
+                    mean.time += costs[i].time / randomNum;
+                }
+            }
+
+            printMappingCost( std::cout, "random mean", mean );
+            printMappingCost( std::cout, "random best", bestCost );
+
+            const char* outFile = args.get( "o" ).asString(0);
+            if ( outFile && outFile[0] )
+                saveMapping( outFile, best );
+        }
+
+        std::cout << "evaluated " << evaluated << " mappings in " << elapsed << " s on " << threads << " threads ("
+                  << ( elapsed > 0.0 ? evaluated / elapsed : 0.0 ) << " per s)\n";
+    }
+    catch( std::string err )
+    {
+        std::cerr << "ERROR OCCURED:\n    " << err << "\n";
+        std::cerr.flush();
+    }
+
+    return 0;
+}
+
+//--------------------------------------------------------
+#endif
@@ -2,6 +2,14 @@
 #define GENERATOR_H
 
 #include "parparser.h"
+#include "bintrace.h"
+#include "delay.h"
+#include "rng.h"
+#include "alias.h"
+#include "tracewriter.h"
+#include "commmtx.h"
+#include "sizedist.h"
+#include "patterns.h"
 #include "mpi.h"
 #include "pugixml.hpp"
 
@@ -14,24 +22,278 @@
 #include <sstream>
 #include <vector>
 #include <math.h>
+#include <algorithm>
 
 #pragma warning(disable : 4996)
 
 //--------------------------------------------------------
 
-struct SParams
+// A collective emitted on all ranks instead of a point-to-point message
+// with the given probability. "kind" is the trace record kind.
+struct SCollParams
 {
-    int procNumber;
+    char kind;
+    float probability;
+    int size;
+};
+
+// One phase of the workload. Phases are generated in config order, each
+// with its own traffic, sizes, delay and volume.
+struct SPhaseParams
+{
+    std::string name;
     std::vector< float > probabilities;
     int averageSendSize;
-    int averageSleepTime;
+    // Point-to-point message sizes; "avrg-send-size" bytes each unless
+    // the config has a "send-size" distribution.
+    SizeDistribution sendSizes;
     float totalTransferedDataKb;
+    // Delay after every record of the phase in microseconds, -1 for the
+    // default of the trace header.
+    int delayUs;
+
+    std::vector< SCollParams > collectives;
+
+    // Replaces the partition-weighted pairs if structured. With "rounds"
+    // every iteration of the pattern starts with a round marker.
+    CommPattern pattern;
+    bool rounds;
+
+    // If "matrix" has ranks, the phase reproduces its pair volumes times
+    // "matrixScale" instead, in the order given by "interleave".
+    SCommGraph matrix;
+    double matrixScale;
+    int interleave;
+};
+
+enum EInterleave
+{
+    INTERLEAVE_SEQUENTIAL  = 0,   // all messages of a pair, pair after pair
+    INTERLEAVE_ROUND_ROBIN = 1,   // one message of every pair per round
+    INTERLEAVE_RANDOM      = 2    // round-robin over a new random order each round
+};
+
+int parseInterleave( const char* name )
+{
+    if ( !name || !name[0] || 0 == strcmp( "round-robin", name ) )
+        return INTERLEAVE_ROUND_ROBIN;
+    if ( 0 == strcmp( "sequential", name ) )
+        return INTERLEAVE_SEQUENTIAL;
+    if ( 0 == strcmp( "random", name ) )
+        return INTERLEAVE_RANDOM;
+    return -1;
+}
+
+struct SParams
+{
+    int procNumber;
+    int averageSleepTime;
+    int sleepUs;
+    int delayMode;
 
     std::string outFile;
     std::string commMtxFile;
+    bool binaryOut;
+
+    // Negative if the configuration does not fix the seed.
+    long long seed;
+
+    // Without <phase> elements the top level parameters form the only
+    // phase and no phase markers are written.
+    std::vector< SPhaseParams > phases;
+    bool phaseMarkers;
 };
 
 //--------------------------------------------------------
+// <parameter name="send-size" dist="..." .../> with the attributes:
+//   constant   value
+//   uniform    min, max
+//   lognormal  median, sigma, max (optional)
+//   bimodal    small, large, p-large
+//   empirical  file ("size count" lines)
+
+void parseSizeDistribution( const pugi::xml_node& node, SizeDistribution& dist )
+{
+    switch ( parseSizeDist( node.attribute( "dist" ).as_string() ) )
+    {
+    case SIZE_CONSTANT:
+        dist.constant( node.attribute( "value" ).as_int(0) );
+        break;
+    case SIZE_UNIFORM:
+        dist.uniform( node.attribute( "min" ).as_int(0), node.attribute( "max" ).as_int(0) );
+        break;
+    case SIZE_LOGNORMAL:
+        dist.lognormal( node.attribute( "median" ).as_int(0), node.attribute( "sigma" ).as_double(-1.0),
+                        node.attribute( "max" ).as_int( SizeDistribution::MAX_SIZE ) );
+        break;
+    case SIZE_BIMODAL:
+        dist.bimodal( node.attribute( "small" ).as_int(0), node.attribute( "large" ).as_int(0),
+                      node.attribute( "p-large" ).as_double(-1.0) );
+        break;
+    case SIZE_EMPIRICAL:
+        dist.loadHistogram( node.attribute( "file" ).as_string() );
+        break;
+    default:
+        throw std::string( "Unknown size distribution. " ).append( __FUNCTION__ );
+    }
+}
+
+//--------------------------------------------------------
+// Parameters that may differ between phases, while being read.
+
+struct SPhaseConfig
+{
+    SPhaseParams phase;
+    bool hasSendSizes;
+    float probsSum;
+    int patternKind;
+    std::string patternGrid;
+    bool patternPeriodic;
+
+    SPhaseConfig()
+        : hasSendSizes( false )
+        , probsSum( 0.0f )
+        , patternKind( PATTERN_RANDOM )
+        , patternPeriodic( true )
+    {
+        phase.averageSendSize = 0;
+        phase.totalTransferedDataKb = -1.0f;
+        phase.delayUs = -1;
+        phase.rounds = false;
+        phase.matrixScale = 1.0;
+        phase.interleave = INTERLEAVE_ROUND_ROBIN;
+    }
+};
+
+// Returns false if "name" is not a phase parameter.
+bool readPhaseParameter( const pugi::xml_node& node, const char* name, SPhaseConfig& config )
+{
+    SPhaseParams& phase = config.phase;
+
+    if ( 0 == strcmp( "avrg-send-size", name ) )
+    {
+        phase.averageSendSize = node.attribute( "value" ).as_int(0);
+    }
+    else if ( 0 == strcmp( "send-size", name ) )
+    {
+        parseSizeDistribution( node, phase.sendSizes );
+        config.hasSendSizes = true;
+    }
+    else if ( 0 == strcmp( "pattern", name ) )
+    {
+        config.patternKind = parsePattern( node.attribute( "value" ).as_string() );
+        if ( config.patternKind < 0 )
+            throw std::string( "Unknown pattern. " ).append( __FUNCTION__ );
+        config.patternGrid = node.attribute( "grid" ).as_string();
+        config.patternPeriodic = node.attribute( "periodic" ).as_bool( true );
+        phase.rounds = node.attribute( "rounds" ).as_bool( isPermutationPattern( config.patternKind ) );
+    }
+    else if ( 0 == strcmp( "matrix", name ) )
+    {
+        loadCommGraph( node.attribute( "file" ).as_string(), phase.matrix );
+        phase.matrixScale = node.attribute( "scale" ).as_double( 1.0 );
+        phase.interleave = parseInterleave( node.attribute( "interleave" ).as_string() );
+        if ( phase.interleave < 0 || phase.matrixScale <= 0.0 )
+            throw std::string( "Invalid matrix parameters. " ).append( __FUNCTION__ );
+    }
+    else if ( 0 == strcmp( "total-transfered-data-kb", name ) )
+    {
+        phase.totalTransferedDataKb = node.attribute( "value" ).as_float(0);
+    }
+    else if ( 0 == strcmp( "collectives", name ) )
+    {
+        phase.collectives.clear();
+        for ( pugi::xml_node collNode = node.child( "coll" ); collNode; collNode = collNode.next_sibling( "coll" ) )
+        {
+            const char* op = collNode.attribute( "op" ).as_string();
+            SCollParams coll;
+            coll.kind = 0 == strcmp( "allreduce", op ) ? 'a' :
+                        0 == strcmp( "bcast", op ) ? 'b' :
+                        0 == strcmp( "alltoallv", op ) ? 'v' : 0;
+            coll.probability = collNode.attribute( "p" ).as_float( -1.0f );
+            coll.size = collNode.attribute( "size" ).as_int( 0 );
+
+            if ( !coll.kind || coll.probability < 0.0f || coll.probability > 1.0f || coll.size <= 0 )
+                throw std::string( "Invalid collective. " ).append( __FUNCTION__ );
+
+            phase.collectives.push_back( coll );
+        }
+    }
+    else if ( 0 == strcmp( "probabilities", name ) )
+    {
+        phase.probabilities.clear();
+        config.probsSum = 0.0f;
+        for ( pugi::xml_node probNode = node.child( "prob" ); probNode; probNode = probNode.next_sibling() )
+        {
+            const float val = probNode.attribute("p").as_float(-1.0f);
+            if ( val < 0.0f || val > 1.0f )
+            {
+                std::cout << "Probability was dropped\r\n";
+                continue;
+            }
+            phase.probabilities.push_back(val);        
+            config.probsSum += val;
+        }
+    }
+    else
+        return false;
+
+    return true;
+}
+
+void finishPhase( SPhaseConfig& config, int procNumber )
+{
+    SPhaseParams& phase = config.phase;
+
+    if ( !config.hasSendSizes && phase.averageSendSize > 0 )
+        phase.sendSizes.constant( phase.averageSendSize );
+
+    // The volume and the pairs come from the matrix.
+    if ( phase.matrix.size > 0 )
+    {
+        if ( !config.hasSendSizes && phase.averageSendSize <= 0 )
+            throw std::string( "Invalid configuration. " ).append( __FUNCTION__ );
+        if ( phase.matrix.size > procNumber )
+            throw std::string( "Matrix has more ranks than the trace. " ).append( __FUNCTION__ );
+        return;
+    }
+
+    if ( ( !config.hasSendSizes && phase.averageSendSize <= 0 ) || phase.totalTransferedDataKb < 0.0f ||
+         ( config.patternKind == PATTERN_RANDOM && phase.probabilities.empty() ) )
+         throw std::string( "Invalid configuration. " ).append( __FUNCTION__ );
+
+    if ( config.patternKind == PATTERN_RANDOM && fabs( config.probsSum - 1.0f ) > 0.001f )
+         throw std::string( "Invalid probabilities. " ).append( __FUNCTION__ );
+
+    if ( config.patternKind != PATTERN_RANDOM )
+    {
+        phase.pattern.build( config.patternKind, procNumber, config.patternGrid, config.patternPeriodic );
+
+        // Otherwise an iteration might never reach its next message.
+        float collProbability = 0.0f;
+        for ( size_t i = 0; i < phase.collectives.size(); ++i )
+            collProbability += phase.collectives[i].probability;
+        if ( collProbability >= 1.0f )
+            throw std::string( "Invalid collectives. " ).append( __FUNCTION__ );
+    }
+}
+
+//--------------------------------------------------------
+// The top level parameters describe the whole trace and the defaults of
+// the phases; every <phase name="..."> element starts from them and
+// overrides what it lists:
+//
+//   <phase name="halo">
+//       <parameter name="pattern" value="stencil2d"/>
+//       <parameter name="total-transfered-data-kb" value="1024"/>
+//       <parameter name="sleep-us" value="200"/>
+//   </phase>
+//
+// A phase with a "matrix" replays the pair volumes of a comm mtx file, in
+// messages of its send sizes; "interleave" is sequential, round-robin
+// (the default) or random, and "scale" multiplies the volumes:
+//
+//   <parameter name="matrix" file="app.mtx" interleave="random" scale="0.5"/>
 
 SParams readXMLConfig( const char* fileName )
 {
@@ -59,31 +321,29 @@ SParams readXMLConfig( const char* fileName )
         throw std::string( "Some problems with config file. " ).append( __FUNCTION__ );
 
     SParams parsedParams;
+    parsedParams.procNumber = 0;
+    parsedParams.averageSleepTime = 0;
+    parsedParams.binaryOut = false;
+    parsedParams.sleepUs = -1;
+    parsedParams.delayMode = -1;
+    parsedParams.seed = -1;
 
-    float probsSum = 0.0;
+    SPhaseConfig defaults;
 
-    for ( pugi::xml_node node = rootNode.child( "parameter" ); node; node = node.next_sibling() )
+    for ( pugi::xml_node node = rootNode.child( "parameter" ); node; node = node.next_sibling( "parameter" ) )
     {
         const char* name = node.attribute( "name" ).as_string(0);
-        if ( !name )
+        if ( !name || readPhaseParameter( node, name, defaults ) )
             continue;
 
         if ( 0 == strcmp( "processors-number", name ) )
         {
             parsedParams.procNumber = node.attribute( "value" ).as_int(0);
         }
-        else if ( 0 == strcmp( "avrg-send-size", name ) )
-        {
-            parsedParams.averageSendSize = node.attribute( "value" ).as_int(0);
-        }
         else if ( 0 == strcmp( "avrg-sleep-time", name ) )
         {
             parsedParams.averageSleepTime = node.attribute( "value" ).as_int(0);
         }
-        else if ( 0 == strcmp( "total-transfered-data-kb", name ) )
-        {
-            parsedParams.totalTransferedDataKb = node.attribute( "value" ).as_float(0);
-        }
         else if ( 0 == strcmp( "out-file", name ) )
         {
             parsedParams.outFile = node.attribute( "value" ).as_string();
@@ -92,29 +352,62 @@ SParams readXMLConfig( const char* fileName )
         {
             parsedParams.commMtxFile = node.attribute( "value" ).as_string();
         }
-        if ( 0 == strcmp( "probabilities", name ) )
+        else if ( 0 == strcmp( "sleep-us", name ) )
         {
-            for ( pugi::xml_node probNode = node.child( "prob" ); probNode; probNode = probNode.next_sibling() )
-            {
-                const float val = probNode.attribute("p").as_float(-1.0f);
-                if ( val < 0.0f || val > 1.0f )
-                {
-                    std::cout << "Probability was dropped\r\n";
-                    continue;
-                }
-                parsedParams.probabilities.push_back(val);        
-                probsSum += val;
-            }
+            parsedParams.sleepUs = node.attribute( "value" ).as_int(-1);
+        }
+        else if ( 0 == strcmp( "delay-mode", name ) )
+        {
+            parsedParams.delayMode = parseDelayMode( node.attribute( "value" ).as_string() );
+            if ( parsedParams.delayMode < 0 )
+                throw std::string( "Unknown delay mode. " ).append( __FUNCTION__ );
+        }
+        else if ( 0 == strcmp( "seed", name ) )
+        {
+            parsedParams.seed = atoll( node.attribute( "value" ).as_string( "-1" ) );
+        }
+        else if ( 0 == strcmp( "out-format", name ) )
+        {
+            parsedParams.binaryOut = 0 == strcmp( "binary", node.attribute( "value" ).as_string() );
         }
     }
 
-    if ( parsedParams.procNumber <= 0 || parsedParams.averageSendSize <= 0 || 
-         parsedParams.averageSleepTime < 0 || parsedParams.outFile.empty() ||
-         parsedParams.totalTransferedDataKb < 0.0f || parsedParams.probabilities.empty() )
+    if ( parsedParams.procNumber <= 0 || parsedParams.averageSleepTime < 0 || parsedParams.outFile.empty() )
          throw std::string( "Invalid configuration. " ).append( __FUNCTION__ );
 
-    if ( fabs( probsSum - 1.0f ) > 0.001f )
-         throw std::string( "Invalid probabilities. " ).append( __FUNCTION__ );
+    for ( pugi::xml_node phaseNode = rootNode.child( "phase" ); phaseNode; phaseNode = phaseNode.next_sibling( "phase" ) )
+    {
+        SPhaseConfig config = defaults;
+        config.phase.name = phaseNode.attribute( "name" ).as_string();
+
+        for ( pugi::xml_node node = phaseNode.child( "parameter" ); node; node = node.next_sibling( "parameter" ) )
+        {
+            const char* name = node.attribute( "name" ).as_string(0);
+            if ( !name || readPhaseParameter( node, name, config ) )
+                continue;
+
+            // The sleep of a phase is written into its records.
+            if ( 0 == strcmp( "sleep-us", name ) )
+                config.phase.delayUs = node.attribute( "value" ).as_int(-1);
+            else if ( 0 == strcmp( "avrg-sleep-time", name ) )
+            {
+                const int sleepMs = node.attribute( "value" ).as_int(-1);
+                config.phase.delayUs = sleepMs >= 0 ? sleepMs * 1000 : -1;
+            }
+            else
+                throw std::string( "Unknown phase parameter. " ).append( __FUNCTION__ );
+        }
+
+        finishPhase( config, parsedParams.procNumber );
+        parsedParams.phases.push_back( config.phase );
+    }
+
+    parsedParams.phaseMarkers = !parsedParams.phases.empty();
+    if ( parsedParams.phases.empty() )
+    {
+        finishPhase( defaults, parsedParams.procNumber );
+        parsedParams.phases.push_back( defaults.phase );
+    }
 
     fclose(fp);
     delete[] buf;
@@ -123,143 +416,531 @@ SParams readXMLConfig( const char* fileName )
 
 //--------------------------------------------------------
 
-void saveCommMtx( long long** commMtx, int size, const char* fileName )
+// Returns the index of the collective to emit next, -1 for a
+// point-to-point message.
+
+int getCollective( const std::vector< SCollParams >& collectives, Rng& rng )
 {
-    std::stringstream outData;
-    int lines = 0;
+    if ( collectives.empty() )
+        return -1;
+
+    float rVal = float( rng.uniform() );
+    for ( size_t i = 0; i < collectives.size(); ++i )
+    {
+        if ( rVal < collectives[i].probability )
+            return int( i );
+        rVal -= collectives[i].probability;
+    }
+
+    return -1;
+}
+
+//--------------------------------------------------------
+
+// Bytes of matrix entry "e", scaled.
+long long pairVolume( const SPhaseParams& phase, long long e )
+{
+    return (long long)( phase.matrix.weights[ size_t( e ) ] * phase.matrixScale + 0.5 );
+}
+
+// Bytes of all pairs of the matrix.
+long long matrixVolume( const SPhaseParams& phase )
+{
+    const SCommGraph& matrix = phase.matrix;
+    long long volume = 0;
+    for ( int u = 0; u < matrix.size; ++u )
+        for ( long long e = matrix.rowPtr[u]; e < matrix.rowPtr[ u + 1 ]; ++e )
+            if ( matrix.adj[ size_t( e ) ] > u )
+                volume += pairVolume( phase, e );
+    return volume;
+}
+
+//--------------------------------------------------------
+// Slice "slice" of "slices" holds 1/slices of the volume of every pair of
+// the matrix, so the slices follow each other as passes over all pairs. A
+// pair's bytes are cut into messages of the phase's sizes, the last one
+// shortened to what is left, and alternate between the two directions, so
+// the comm mtx of the trace is the input matrix.
+
+long long generateMatrixSlice( const SPhaseParams& phase, Rng& rng, long long slice, long long slices, TraceWriter& out, SparseCommMtx* commMtx )
+{
+    const SCommGraph& matrix = phase.matrix;
+
+    struct SPair
+    {
+        int from;
+        int to;
+        long long left;
+    };
 
-    for ( int i = 0; i < size; ++i )
+    std::vector< SPair > pairs;
+    for ( int u = 0; u < matrix.size; ++u )
     {
-        for ( int q = 0; q < size; ++q )
+        for ( long long e = matrix.rowPtr[u]; e < matrix.rowPtr[ u + 1 ]; ++e )
         {
-            if ( commMtx[i][q] != 0 )
+            const int v = matrix.adj[ size_t( e ) ];
+            const long long volume = pairVolume( phase, e );
+            if ( v < u || volume <= 0 )
+                continue;
+
+            SPair pair;
+            pair.from = u;
+            pair.to = v;
+            pair.left = volume / slices + ( slice < volume % slices ? 1 : 0 );
+            if ( pair.left > 0 )
+                pairs.push_back( pair );
+        }
+    }
+
+    long long transfered = 0;
+    std::vector< SPair* > active;
+    for ( size_t i = 0; i < pairs.size(); ++i )
+        active.push_back( &pairs[i] );
+
+    while ( !active.empty() )
+    {
+        if ( phase.interleave == INTERLEAVE_RANDOM )
+        {
+            for ( size_t i = active.size() - 1; i > 0; --i )
+                std::swap( active[i], active[ size_t( rng.below( i + 1 ) ) ] );
+        }
+
+        size_t kept = 0;
+        for ( size_t i = 0; i < active.size(); ++i )
+        {
+            SPair& pair = *active[i];
+            do
             {
-                outData << i << " " << q << " " << commMtx[i][q] << "\n";
-                ++lines;
+                const int size = int( std::min( (long long)phase.sendSizes.sample( rng ), pair.left ) );
+                out.record( 's', pair.from, pair.to, size, phase.delayUs );
+                if ( commMtx )
+                    commMtx->add( pair.from, pair.to, size );
+
+                std::swap( pair.from, pair.to );
+                pair.left -= size;
+                transfered += size;
             }
-         }
+            while ( phase.interleave == INTERLEAVE_SEQUENTIAL && pair.left > 0 );
+
+            if ( pair.left > 0 )
+                active[ kept++ ] = &pair;
+        }
+        active.resize( kept );
     }
 
-    FILE* fp = fopen( fileName, "wb" );
-    if ( !fp ) 
-        throw std::string( "Problems with comm mtx file. " ).append( __FUNCTION__ );
+    return transfered;
+}
+
+//--------------------------------------------------------
+
+// Expected bytes of one iteration of a structured pattern. Before every
+// message collectives are drawn until a draw is not one, which for a
+// total collective probability q adds q / (1 - q) collectives on average.
+
+double iterationVolume( const SParams& params, const SPhaseParams& phase )
+{
+    double collProbability = 0.0;
+    double collVolume = 0.0;
+    for ( size_t i = 0; i < phase.collectives.size(); ++i )
+    {
+        const SCollParams& coll = phase.collectives[i];
+        collProbability += coll.probability;
+        collVolume += coll.probability * collectiveVolume( coll.kind, coll.size, params.procNumber );
+    }
+
+    return phase.pattern.messages() * ( phase.sendSizes.mean() + collVolume / ( 1.0 - collProbability ) );
+}
+
+// Iterations of a structured phase, enough to reach its volume on average.
+// The count is fixed before generation, so the trace does not grow with
+// the number of generator ranks.
+long long phaseIterations( const SParams& params, const SPhaseParams& phase )
+{
+    const double target = double( phase.totalTransferedDataKb ) * 1024;
+    return target > 0.0 ? (long long)ceil( target / iterationVolume( params, phase ) ) : 0;
+}
+
+//--------------------------------------------------------
+// A phase is cut into units of work that depend on the config alone: an
+// iteration of a structured pattern, a slice of every pair of a matrix
+// phase or a chunk of a random phase's volume. Unit u of phase p draws
+// from stream (p, u) of the seed, so a seed gives the same trace whatever
+// the number of generator ranks. Random chunks hold at least UNIT_MESSAGES
+// average messages, matrix slices MATRIX_SLICE_BYTES.
+
+enum
+{
+    UNIT_BYTES         = 1 << 20,
+    UNIT_MESSAGES      = 256,
+    MATRIX_SLICE_BYTES = 64 << 20
+};
 
-    std::stringstream desc;
-    desc << size << " " << size << " " << lines << "\n";
+long long phaseUnits( const SParams& params, const SPhaseParams& phase )
+{
+    if ( phase.matrix.size > 0 )
+    {
+        const long long volume = matrixVolume( phase );
+        return std::max( 1LL, ( volume + MATRIX_SLICE_BYTES - 1 ) / MATRIX_SLICE_BYTES );
+    }
 
-    size_t res = fwrite( desc.str().c_str(), 1, desc.str().length(), fp );
-    if ( res != desc.str().length() )
-        throw std::string( "Error while comm mtx writing. " ).append( __FUNCTION__ );
+    if ( phase.pattern.structured() )
+        return phaseIterations( params, phase );
 
-    res = fwrite( outData.str().c_str(), 1, outData.str().length(), fp );
-    if ( res != outData.str().length() )
-        throw std::string( "Error while comm mtx writing. " ).append( __FUNCTION__ );
+    const double target = double( phase.totalTransferedDataKb ) * 1024;
+    const double chunk = std::max( double( UNIT_BYTES ), UNIT_MESSAGES * phase.sendSizes.mean() );
+    return target > 0.0 ? (long long)ceil( target / chunk ) : 0;
+}
 
-    fclose( fp );
+uint64_t unitStream( size_t phase, long long unit )
+{
+    return ( uint64_t( phase ) << 48 ) + uint64_t( unit );
+}
+
+// The rank's units [first, first + count) of a phase of "units"; with
+// rounds, the rank's first iteration opens round "firstRound".
+struct SPhaseShare
+{
+    long long units;
+    long long first;
+    long long count;
+    long long firstRound;
+};
+
+// Draws whether the next record is a collective and if so emits it and
+// returns the bytes it transfers; -1 for a point-to-point message.
+long long generateCollective( const SParams& params, const SPhaseParams& phase, Rng& rng, TraceWriter& out )
+{
+    const int coll = getCollective( phase.collectives, rng );
+    if ( coll < 0 )
+        return -1;
+
+    const char collKind = phase.collectives[ coll ].kind;
+    const int size = phase.collectives[ coll ].size;
+    const int root = collKind == 'b' ? int( rng.below( params.procNumber ) ) : 0;
+
+    out.record( collKind, 0, root, size, phase.delayUs );
+    return collectiveVolume( collKind, size, params.procNumber );
 }
 
 //--------------------------------------------------------
 
-int getPartition( const std::vector<float>& probs )
+// Generates one iteration of a structured phase, opened by round marker
+// "round" if the phase has rounds.
+
+long long generateIteration( const SParams& params, const SPhaseParams& phase, Rng& rng, long long round,
+                             TraceWriter& out, SparseCommMtx* commMtx )
 {
-    float rVal = float(rand()) / RAND_MAX;
+    long long currentTransferedData = 0;
 
-    float pSum = 0.0f;
-    int part = 0;
-    for ( int i = 0; i < probs.size(); ++i )
+    CommPattern pattern = phase.pattern;
+    pattern.nextIteration( rng );
+    if ( phase.rounds )
+        out.record( 'r', int( round ), 0, 0 );
+
+    const long long slots = pattern.slots();
+    for ( long long slot = 0; slot < slots; ++slot )
     {
-        pSum += probs[i];
-        if ( pSum >= rVal )
-            break;
+        int fromIdx = 0;
+        int toIdx = 0;
+        if ( !pattern.pair( slot, fromIdx, toIdx ) )
+            continue;
+
+        long long collVolume = 0;
+        while ( ( collVolume = generateCollective( params, phase, rng, out ) ) >= 0 )
+            currentTransferedData += collVolume;
+
+        const int size = phase.sendSizes.sample( rng );
+        if ( commMtx )
+            commMtx->add( fromIdx, toIdx, size );
 
-        ++part;
+        out.record( 's', fromIdx, toIdx, size, phase.delayUs );
+        currentTransferedData += size;
     }
 
-    return part;
+    return currentTransferedData;
+}
+
+// Generates a chunk of "target" bytes of a random phase.
+
+long long generateChunk( const SParams& params, const SPhaseParams& phase, Rng& rng, long long target,
+                         TraceWriter& out, SparseCommMtx* commMtx )
+{
+    long long currentTransferedData = 0;
+
+    // Partitions are drawn in batches from an alias table.
+    const int pSize = params.procNumber / int( phase.probabilities.size() );
+    AliasTable partitionTable( phase.probabilities );
+    std::vector< int > partitions( 4096 );
+    size_t nextPartition = partitions.size();
+
+    while ( currentTransferedData < target )
+    {
+        const long long collVolume = generateCollective( params, phase, rng, out );
+        if ( collVolume >= 0 )
+        {
+            currentTransferedData += collVolume;
+            continue;
+        }
+
+        if ( nextPartition + 2 > partitions.size() )
+        {
+            partitionTable.sample( rng, &partitions[0], partitions.size() );
+            nextPartition = 0;
+        }
+        const int fromPartition = partitions[ nextPartition++ ];
+        const int toPartition   = partitions[ nextPartition++ ];
+
+        const int from = int( rng.below( pSize ) );
+        const int to   = int( rng.below( pSize ) );
+        if ( from == to && fromPartition == toPartition )
+            continue;
+
+        const int fromIdx = fromPartition * pSize + from;
+        const int toIdx   = toPartition * pSize + to;
+
+        const int size = phase.sendSizes.sample( rng );
+        if ( commMtx )
+            commMtx->add( fromIdx, toIdx, size );
+
+        out.record( 's', fromIdx, toIdx, size, phase.delayUs );
+        currentTransferedData += size;
+    }
+
+    return currentTransferedData;
+}
+
+// Generates the records of the rank's units of phase p into "out" and
+// returns the bytes they transfer. "commMtx" may be 0.
+long long generateShare( const SParams& params, size_t p, uint64_t seed, const SPhaseShare& share,
+                         TraceWriter& out, SparseCommMtx* commMtx, bool progress )
+{
+    const SPhaseParams& phase = params.phases[p];
+    const long long target = (long long)( phase.totalTransferedDataKb * 1024 );
+
+    long long transfered = 0;
+    for ( long long i = 0; i < share.count; ++i )
+    {
+        const long long unit = share.first + i;
+        Rng rng( seed, unitStream( p, unit ) );
+
+        if ( phase.matrix.size > 0 )
+            transfered += generateMatrixSlice( phase, rng, unit, share.units, out, commMtx );
+        else if ( phase.pattern.structured() )
+            transfered += generateIteration( params, phase, rng, share.firstRound + i, out, commMtx );
+        else
+        {
+            const long long chunk = target / share.units + ( unit < target % share.units ? 1 : 0 );
+            transfered += generateChunk( params, phase, rng, chunk, out, commMtx );
+        }
+
+        if ( progress )
+            std::cout << i + 1 << "/" << share.count << "\n";
+    }
+
+    return transfered;
 }
 
 //--------------------------------------------------------
+// Measures the rank's shares of all phases; "lengths" gets the bytes the
+// share of every phase takes in the file, "writes" the buffer writes it
+// takes.
 
-int generator_routine( parparser& args )
+long long measurePhases( const SParams& params, uint64_t seed, const std::vector< SPhaseShare >& shares,
+                         TraceWriter& writer, SparseCommMtx* commMtx,
+                         std::vector< long long >& lengths, std::vector< long long >& writes )
 {
     int rank = 0;
     MPI_Comm_rank( MPI_COMM_WORLD, &rank );
-    if ( rank != 0 )
-        return 0;
 
-    srand( unsigned(time(0)) );
+    lengths.resize( params.phases.size() );
+    writes.resize( params.phases.size() );
+    long long transfered = 0;
+
+    writer.startCounting();
+    for ( size_t p = 0; p < params.phases.size(); ++p )
+    {
+        const long long length = writer.length();
+        const long long written = writer.writes();
+        if ( params.phaseMarkers && rank == 0 )
+            writer.record( 'p', int(p), 0, 0 );
+        transfered += generateShare( params, p, seed, shares[p], writer, commMtx, false );
+        writer.finish();
+        lengths[p] = writer.length() - length;
+        writes[p] = writer.writes() - written;
+    }
+
+    return transfered;
+}
+
+// The rank's share of phase p starts after all earlier phases and the
+// shares of lower ranks in phase p.
+void placePhases( const std::vector< long long >& lengths, std::vector< long long >& offsets )
+{
+    int rank = 0;
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+
+    const size_t phasesNum = lengths.size();
+    std::vector< long long > before( phasesNum, 0 );
+    std::vector< long long > totals( phasesNum, 0 );
+    MPI_Exscan( const_cast< long long* >( &lengths[0] ), &before[0], int( phasesNum ), MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD );
+    MPI_Allreduce( const_cast< long long* >( &lengths[0] ), &totals[0], int( phasesNum ), MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD );
+    if ( rank == 0 )
+        std::fill( before.begin(), before.end(), 0LL );
+
+    offsets.resize( phasesNum );
+    long long phaseStart = 0;
+    for ( size_t p = 0; p < phasesNum; ++p )
+    {
+        offsets[p] = phaseStart + before[p];
+        phaseStart += totals[p];
+    }
+}
+
+//--------------------------------------------------------
+// Every rank generates an equal, contiguous range of the units of every
+// phase. Phases follow each other in config order (rank 0 opens each with
+// a phase marker) and within a phase the units follow each other in
+// order, so the trace is the same for any number of ranks. The units are
+// generated twice from their streams: first only measured (and added to
+// the comm matrix), which gives the totals for the header and the file
+// offsets of the rank, then streamed to the file. The comm matrices are
+// summed on rank 0.
+
+int generator_routine( parparser& args )
+{
+    int rank = 0;
+    int commSize = 0;
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    MPI_Comm_size( MPI_COMM_WORLD, &commSize );
 
     try
     {       
         const char* configFile = args.get( "xml" ).asString(0);
         SParams params = readXMLConfig( configFile );
 
-        const long long targetTransferedData = (long long)( params.totalTransferedDataKb * 1024 );
-        long long currentTransferedData = 0;
-        long long curProgress = 0;
-
-        long long** commMtx = new long long*[ params.procNumber ];
-        for ( int i = 0; i < params.procNumber; ++i )
+        // -seed overrides the config; without either every run differs.
+        // The same seed always gives the same trace.
+        long long seed = params.seed;
+        const char* seedArg = args.get( "seed" ).asString(0);
+        if ( seedArg && seedArg[0] )
+            seed = atoll( seedArg );
+        if ( seed < 0 )
+            seed = (long long)time(0);
+        MPI_Bcast( &seed, 1, MPI_LONG_LONG, 0, MPI_COMM_WORLD );
+        if ( rank == 0 )
+            std::cout << "seed: " << seed << "\n";
+
+        // A round is an iteration, so the rounds of every rank are known
+        // up front.
+        const size_t phasesNum = params.phases.size();
+        std::vector< SPhaseShare > shares( phasesNum );
+        long long rounds = 0;
+        for ( size_t p = 0; p < phasesNum; ++p )
         {
-            commMtx[i] = new long long[ params.procNumber ];
-            memset( commMtx[i], 0, params.procNumber * sizeof(**commMtx) );
+            const SPhaseParams& phase = params.phases[p];
+            SPhaseShare& share = shares[p];
+
+            share.units = phaseUnits( params, phase );
+            share.first = share.units * rank / commSize;
+            share.count = share.units * ( rank + 1 ) / commSize - share.first;
+            share.firstRound = rounds + share.first;
+            if ( phase.rounds && phase.pattern.structured() )
+                rounds += share.units;
         }
 
-        std::stringstream trace;
-        const int pSize = params.procNumber / params.probabilities.size();
-
-        while ( currentTransferedData < targetTransferedData )
+        const bool saveMtx = !params.commMtxFile.empty();
+        SparseCommMtx commMtx( params.procNumber );
+
+        const int bufferMb = args.get( "write-buf-mb" ).asInt( 64 );
+        if ( bufferMb <= 0 || bufferMb > 1024 )
+            throw std::string( "Invalid write buffer size. " ).append( __FUNCTION__ );
+        // Binary records carry a delay only if some phase sets one.
+        bool delays = false;
+        for ( size_t p = 0; p < phasesNum; ++p )
+            delays = delays || params.phases[p].delayUs >= 0;
+        const int recordSize = binRecordSize( delays, false );
+        TraceWriter writer( params.binaryOut, size_t( bufferMb ) * 1024 * 1024, recordSize );
+
+        std::vector< long long > lengths;
+        std::vector< long long > offsets;
+        std::vector< long long > writes;
+        const long long transfered = measurePhases( params, uint64_t( seed ), shares, writer, saveMtx ? &commMtx : 0, lengths, writes );
+        placePhases( lengths, offsets );
+
+        // The phases are written collectively, so every rank issues as many
+        // writes as the busiest one.
+        std::vector< long long > phaseWrites( phasesNum, 0 );
+        MPI_Allreduce( &writes[0], &phaseWrites[0], int( phasesNum ), MPI_LONG_LONG, MPI_MAX, MPI_COMM_WORLD );
+
+        long long localTotals[2] = { transfered, writer.records() };
+        long long totals[2] = { 0, 0 };
+        MPI_Allreduce( localTotals, totals, 2, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD );
+
+        // The header's buffer size is the largest message of the trace.
+        int localMaxSize = writer.maxSize();
+        int maxSize = 0;
+        MPI_Allreduce( &localMaxSize, &maxSize, 1, MPI_INT, MPI_MAX, MPI_COMM_WORLD );
+
+        std::string header;
+        if ( params.binaryOut )
         {
-            const int fromPartition = getPartition( params.probabilities );
-            const int toPartition   = getPartition( params.probabilities );
-
-            const int from = rand() % pSize;
-            const int to   = rand() % pSize;
-            if ( from == to && fromPartition == toPartition )
-                continue;
-                
-            const int fromIdx = fromPartition * pSize + from;
-            const int toIdx   = toPartition * pSize + to;
-            commMtx[ fromIdx ][ toIdx ] += params.averageSendSize;
-            commMtx[ toIdx ][ fromIdx ] += params.averageSendSize;
-
-            trace << "s " << fromIdx << " " << toIdx << " " << params.averageSendSize << "\n";
-            currentTransferedData += params.averageSendSize;
-
-            if ( currentTransferedData / 1024 > curProgress )
-            {
-                std::cout << currentTransferedData / 1024 << "/" << params.totalTransferedDataKb << "\n";
-                curProgress = currentTransferedData / 1024;
-            }
+            SBinTraceHeader binHeader;
+            initBinTraceHeader( binHeader );
+            binHeader.recordSize = recordSize;
+            binHeader.procsNum   = params.procNumber;
+            binHeader.bufSize    = maxSize;
+            binHeader.sleepTime  = params.averageSleepTime;
+            binHeader.sleepUs    = params.sleepUs;
+            binHeader.delayMode  = params.delayMode;
+            binHeader.recordsNum = totals[1];
+            binHeader.transfered = totals[0];
+            header.assign( (const char*)&binHeader, sizeof(binHeader) );
+        }
+        else
+        {
+            std::stringstream comments;
+            comments << "#transfered: " << totals[0] << "\n";
+            comments << "%procs_num: " << params.procNumber << "\n";
+            comments << "%transfer_buf: " << maxSize << "\n";
+            comments << "%sleep: " << params.averageSleepTime << "\n";
+            if ( params.sleepUs >= 0 )
+                comments << "%sleep_us: " << params.sleepUs << "\n";
+            if ( params.delayMode >= 0 )
+                comments << "%delay_mode: " << delayModeName( params.delayMode ) << "\n";
+            comments << "-------------------------\n";
+            header = comments.str();
         }
 
-        std::stringstream comments;
-        comments << "#transfered: " << currentTransferedData << "\n";
-        comments << "%procs_num: " << params.procNumber << "\n";
-        comments << "%transfer_buf: " << params.averageSendSize << "\n";
-        comments << "%sleep: " << params.averageSleepTime << "\n";
-        comments << "-------------------------\n";
-
-        FILE* fp = fopen( params.outFile.c_str(), "wb" );
-        if ( !fp ) 
+        MPI_File fp = MPI_FILE_NULL;
+        if ( MPI_SUCCESS != MPI_File_open( MPI_COMM_WORLD, const_cast<char*>( params.outFile.c_str() ), MPI_MODE_CREATE | MPI_MODE_WRONLY, MPI_INFO_NULL, &fp ) )
             throw std::string( "Problems with out file. " ).append( __FUNCTION__ );
+        MPI_File_set_size( fp, 0 );
 
-        size_t res = fwrite( comments.str().c_str(), 1, comments.str().length(), fp );
-        if ( res != comments.str().length() )
-            throw std::string( "Error while out file writing. " ).append( __FUNCTION__ );
-
-        res = fwrite( trace.str().c_str(), 1, trace.str().length(), fp );
-        if ( res != trace.str().length() )
-            throw std::string( "Error while out file writing. " ).append( __FUNCTION__ );
-
-        if ( !params.commMtxFile.empty() )
-            saveCommMtx( commMtx, params.procNumber, params.commMtxFile.c_str() );
+        if ( rank == 0 )
+        {
+            MPI_Status status;
+            MPI_File_write_at( fp, 0, const_cast<char*>( header.c_str() ), int( header.length() ), MPI_CHAR, &status );
+        }
 
-        fclose(fp);
-        for ( int i = 0; i < params.procNumber; ++i )
-            delete[] commMtx[i];
+        for ( size_t p = 0; p < phasesNum; ++p )
+        {
+            if ( rank == 0 && params.phaseMarkers )
+                std::cout << "phase " << p << " (" << params.phases[p].name << ")\n";
+
+            writer.startWriting( fp, MPI_Offset( header.length() + offsets[p] ), phaseWrites[p] );
+            if ( params.phaseMarkers && rank == 0 )
+                writer.record( 'p', int(p), 0, 0 );
+            generateShare( params, p, uint64_t( seed ), shares[p], writer, 0, rank == 0 );
+            writer.finish();
+        }
+        MPI_File_close( &fp );
 
-        delete[] commMtx;
+        if ( saveMtx )
+        {
+            commMtx.reduce( MPI_COMM_WORLD );
+            if ( rank == 0 )
+                saveCommMtx( commMtx, params.commMtxFile.c_str() );
+        }
     }
     catch( std::string err )
     {        
@@ -0,0 +1,163 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include "mpi.h"
+
+#include <vector>
+#include <iostream>
+#include <iomanip>
+
+//--------------------------------------------------------
+// Per-operation latency histogram. Latencies are kept in nanoseconds in
+// log2 buckets split into 8 linear sub-buckets (at most 12.5% relative
+// error), one histogram per power-of-two message size class. Adding a
+// sample is a couple of shifts and an increment.
+
+class LatencyHistogram
+{
+public:
+    enum
+    {
+        SUB_BITS = 3,
+        SUB_BUCKETS = 1 << SUB_BITS,
+        MAX_EXP = 44,
+        BUCKETS = ( MAX_EXP - SUB_BITS + 2 ) * SUB_BUCKETS,
+        SIZE_CLASSES = 33
+    };
+
+    LatencyHistogram()
+        : m_counts( SIZE_CLASSES * BUCKETS, 0 )
+        , m_max( SIZE_CLASSES, 0 )
+    {}
+
+    static int sizeClass( int size )
+    {
+        int cls = 0;
+        unsigned int val = size > 0 ? unsigned( size ) : 0u;
+        while ( val )
+        {
+            ++cls;
+            val >>= 1;
+        }
+        return cls;
+    }
+
+    static int bucket( long long ns )
+    {
+        if ( ns < SUB_BUCKETS )
+            return ns < 0 ? 0 : int( ns );
+
+        int exp = 0;
+        for ( long long val = ns; val > 1; val >>= 1 )
+            ++exp;
+        if ( exp > MAX_EXP )
+            return BUCKETS - 1;
+
+        const int sub = int( ( ns >> ( exp - SUB_BITS ) ) & ( SUB_BUCKETS - 1 ) );
+        return ( exp - SUB_BITS + 1 ) * SUB_BUCKETS + sub;
+    }
+
+    static long long bucketUpper( int idx )
+    {
+        if ( idx < SUB_BUCKETS )
+            return idx;
+
+        const int exp = idx / SUB_BUCKETS + SUB_BITS - 1;
+        const int sub = idx % SUB_BUCKETS;
+        const long long width = 1LL << ( exp - SUB_BITS );
+        return ( (long long)( SUB_BUCKETS + sub ) << ( exp - SUB_BITS ) ) + width - 1;
+    }
+
+    void add( int size, double seconds )
+    {
+        const long long ns = (long long)( seconds * 1e9 );
+        const int cls = sizeClass( size );
+        ++m_counts[ cls * BUCKETS + bucket( ns ) ];
+        if ( ns > m_max[ cls ] )
+            m_max[ cls ] = ns;
+    }
+
+    void reduce( MPI_Comm comm, int root )
+    {
+        int rank = 0;
+        MPI_Comm_rank( comm, &rank );
+
+        std::vector< long long > counts( m_counts.size() );
+        std::vector< long long > maxs( m_max.size() );
+        MPI_Reduce( &m_counts[0], &counts[0], int( m_counts.size() ), MPI_LONG_LONG, MPI_SUM, root, comm );
+        MPI_Reduce( &m_max[0], &maxs[0], int( m_max.size() ), MPI_LONG_LONG, MPI_MAX, root, comm );
+
+        if ( rank == root )
+        {
+            m_counts.swap( counts );
+            m_max.swap( maxs );
+        }
+    }
+
+    void print( std::ostream& out ) const
+    {
+        static const double quantiles[] = { 0.5, 0.9, 0.99, 0.999 };
+        static const int quantilesNum = sizeof(quantiles) / sizeof(quantiles[0]);
+
+        out << "latency, us:\n";
+        out << std::setw(12) << "size<=" << std::setw(12) << "count" << std::setw(12) << "p50"
+            << std::setw(12) << "p90" << std::setw(12) << "p99" << std::setw(12) << "p99.9"
+            << std::setw(12) << "max" << "\n";
+
+        std::vector< long long > all( BUCKETS, 0 );
+        long long allMax = 0;
+
+        for ( int cls = 0; cls <= SIZE_CLASSES; ++cls )
+        {
+            const bool total = cls == SIZE_CLASSES;
+            const long long* counts = total ? &all[0] : &m_counts[ cls * BUCKETS ];
+            const long long maxNs = total ? allMax : m_max[ cls ];
+
+            long long samples = 0;
+            for ( int i = 0; i < BUCKETS; ++i )
+            {
+                samples += counts[i];
+                if ( !total )
+                    all[i] += counts[i];
+            }
+            if ( !total && maxNs > allMax )
+                allMax = maxNs;
+
+            if ( samples == 0 )
+                continue;
+
+            if ( total )
+                out << std::setw(12) << "all";
+            else
+                out << std::setw(12) << ( cls == 0 ? 0LL : ( 1LL << cls ) - 1 );
+            out << std::setw(12) << samples;
+
+            for ( int q = 0; q < quantilesNum; ++q )
+            {
+                const long long target = (long long)( quantiles[q] * samples + 0.5 );
+                long long acc = 0;
+                int idx = 0;
+                for ( ; idx < BUCKETS - 1; ++idx )
+                {
+                    acc += counts[ idx ];
+                    if ( acc >= target && acc > 0 )
+                        break;
+                }
+
+                long long upper = bucketUpper( idx );
+                if ( upper > maxNs )
+                    upper = maxNs;
+                out << std::setw(12) << std::fixed << std::setprecision(2) << upper / 1000.0;
+            }
+
+            out << std::setw(12) << std::fixed << std::setprecision(2) << maxNs / 1000.0 << "\n";
+        }
+    }
+
+private:
+    std::vector< long long > m_counts;
+    std::vector< long long > m_max;
+};
+
+//--------------------------------------------------------
+#endif
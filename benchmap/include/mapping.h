@@ -0,0 +1,491 @@
+#ifndef MAPPING_H
+#define MAPPING_H
+
+#include "commmtx.h"
+#include "distance.h"
+#include "parparser.h"
+#include "mpi.h"
+
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <queue>
+#include <utility>
+#include <algorithm>
+
+//--------------------------------------------------------
+// Sum over all communicating pairs of bytes times the distance between
+// the cores they are mapped to.
+
+double hopBytes( const SCommGraph& graph, const DistanceModel& dist, const std::vector< int >& mapping )
+{
+    double total = 0.0;
+    for ( int u = 0; u < graph.size; ++u )
+    {
+        for ( long long e = graph.rowPtr[u]; e < graph.rowPtr[ u + 1 ]; ++e )
+        {
+            const int v = graph.adj[ size_t( e ) ];
+            if ( v > u )
+                total += graph.weights[ size_t( e ) ] * dist( mapping[u], mapping[v] );
+        }
+    }
+    return total;
+}
+
+//--------------------------------------------------------
+// A mapping file holds the number of ranks followed by "rank core" lines.
+
+void saveMapping( const char* fileName, const std::vector< int >& mapping )
+{
+    std::ofstream out( fileName );
+    if ( !out.good() )
+        throw std::string( "Problems with mapping file. " ).append( __FUNCTION__ );
+
+    out << mapping.size() << "\n";
+    for ( size_t i = 0; i < mapping.size(); ++i )
+        out << i << " " << mapping[i] << "\n";
+}
+
+void readMapping( const char* fileName, std::vector< int >& mapping )
+{
+    std::ifstream in( fileName );
+    if ( !in.good() )
+        throw std::string( "Problems with mapping file. " ).append( __FUNCTION__ );
+
+    int count = 0;
+    in >> count;
+    if ( !in.good() || count <= 0 )
+        throw std::string( "Invalid mapping header. " ).append( __FUNCTION__ );
+
+    mapping.assign( count, -1 );
+    int rank = 0;
+    int core = 0;
+    while ( in >> rank >> core )
+    {
+        if ( rank < 0 || rank >= count || core < 0 )
+            throw std::string( "Invalid mapping entry. " ).append( __FUNCTION__ );
+        mapping[ rank ] = core;
+    }
+
+    for ( int i = 0; i < count; ++i )
+        if ( mapping[i] < 0 )
+            throw std::string( "Mapping is incomplete. " ).append( __FUNCTION__ );
+}
+
+//--------------------------------------------------------
+// Trace rank hosted by "rank" under a placement (trace rank -> rank of a
+// communicator of "commSize"), or -1 if it hosts none.
+
+int placedTraceRank( const std::vector< int >& placement, int commSize, int rank )
+{
+    std::vector< char > used( commSize, 0 );
+    int hosted = -1;
+    for ( size_t i = 0; i < placement.size(); ++i )
+    {
+        if ( placement[i] >= commSize )
+            throw std::string( "Mapping does not fit the communicator. " ).append( __FUNCTION__ );
+        if ( used[ placement[i] ] )
+            throw std::string( "Mapping places two ranks on one core. " ).append( __FUNCTION__ );
+
+        used[ placement[i] ] = 1;
+        if ( placement[i] == rank )
+            hosted = int( i );
+    }
+    return hosted;
+}
+
+//--------------------------------------------------------
+// Maps ranks onto cores by recursive bisection: the core set is split in
+// two along the topology, the ranks are split into parts of matching size
+// with the smallest cut, and both halves are mapped recursively. Each rank
+// bisection starts from greedy graph growing and is refined with
+// Kernighan-Lin pair swaps; the gains are doubles, so the candidates are
+// kept in lazily updated heaps instead of FM gain buckets.
+
+class RecursiveBisection
+{
+public:
+    RecursiveBisection( const SCommGraph& graph, const DistanceModel& dist )
+        : m_graph( graph )
+        , m_dist( dist )
+        , m_where( graph.size, -1 )
+        , m_gain( graph.size, 0.0 )
+        , m_locked( graph.size, 0 )
+        , m_passes( 8 )
+    {}
+
+    void setPasses( int passes ) { m_passes = passes; }
+
+    void run( std::vector< int >& mapping )
+    {
+        if ( m_dist.cores() < m_graph.size )
+            throw std::string( "Topology has fewer cores than ranks. " ).append( __FUNCTION__ );
+
+        mapping.assign( m_graph.size, -1 );
+
+        std::vector< int > procs( m_graph.size );
+        for ( int i = 0; i < m_graph.size; ++i )
+            procs[i] = i;
+
+        std::vector< int > cores( m_dist.cores() );
+        for ( int i = 0; i < m_dist.cores(); ++i )
+            cores[i] = i;
+
+        map( procs, cores, mapping );
+    }
+
+private:
+    typedef std::pair< double, int > TGainEntry;
+    typedef std::priority_queue< TGainEntry > TGainHeap;
+
+    void map( std::vector< int >& procs, std::vector< int >& cores, std::vector< int >& mapping )
+    {
+        if ( procs.empty() )
+            return;
+
+        if ( procs.size() == 1 || cores.size() == 1 )
+        {
+            for ( size_t i = 0; i < procs.size(); ++i )
+                mapping[ procs[i] ] = cores[i];
+            return;
+        }
+
+        std::vector< int > leftCores;
+        std::vector< int > rightCores;
+        splitCores( cores, leftCores, rightCores );
+        std::vector< int >().swap( cores );
+
+        // Spare cores are left at the end, so that ranks are packed as
+        // tightly as the hop-bytes objective wants.
+        const size_t leftProcs = std::min( procs.size(), leftCores.size() );
+
+        std::vector< int > left;
+        std::vector< int > right;
+        bisect( procs, leftProcs, left, right );
+        std::vector< int >().swap( procs );
+
+        map( left, leftCores, mapping );
+        map( right, rightCores, mapping );
+    }
+
+    // Hierarchical models are split at the group boundary of the outermost
+    // level the cores span that is closest to the middle. For a distance
+    // matrix the cores are ordered by how much closer they are to one of
+    // two far-apart seeds than to the other, and cut in half.
+    void splitCores( const std::vector< int >& cores, std::vector< int >& left, std::vector< int >& right )
+    {
+        size_t cut = cores.size() / 2;
+
+        if ( m_dist.hierarchical() )
+        {
+            int level = 0;
+            while ( level < m_dist.levels() - 1 &&
+                    cores.front() / m_dist.levelStride( level ) == cores.back() / m_dist.levelStride( level ) )
+                ++level;
+
+            const long long stride = m_dist.levelStride( level );
+            size_t best = cores.size();
+            for ( size_t i = 1; i < cores.size(); ++i )
+            {
+                if ( cores[ i - 1 ] / stride == cores[i] / stride )
+                    continue;
+                if ( best == cores.size() || absDiff( i, cores.size() / 2 ) < absDiff( best, cores.size() / 2 ) )
+                    best = i;
+            }
+            if ( best < cores.size() )
+                cut = best;
+
+            left.assign( cores.begin(), cores.begin() + cut );
+            right.assign( cores.begin() + cut, cores.end() );
+            return;
+        }
+
+        const int seedA = farthest( cores, cores.front() );
+        const int seedB = farthest( cores, seedA );
+
+        std::vector< TGainEntry > order( cores.size() );
+        for ( size_t i = 0; i < cores.size(); ++i )
+            order[i] = TGainEntry( m_dist( cores[i], seedA ) - m_dist( cores[i], seedB ), cores[i] );
+        std::sort( order.begin(), order.end() );
+
+        left.clear();
+        right.clear();
+        for ( size_t i = 0; i < order.size(); ++i )
+            ( i < cut ? left : right ).push_back( order[i].second );
+        std::sort( left.begin(), left.end() );
+        std::sort( right.begin(), right.end() );
+    }
+
+    int farthest( const std::vector< int >& cores, int from ) const
+    {
+        int best = cores.front();
+        double bestDist = -1.0;
+        for ( size_t i = 0; i < cores.size(); ++i )
+        {
+            const double d = m_dist( from, cores[i] );
+            if ( d > bestDist )
+            {
+                bestDist = d;
+                best = cores[i];
+            }
+        }
+        return best;
+    }
+
+    static size_t absDiff( size_t a, size_t b ) { return a > b ? a - b : b - a; }
+
+    //--------------------------------------------------------
+
+    void bisect( const std::vector< int >& procs, size_t leftCount, std::vector< int >& left, std::vector< int >& right )
+    {
+        for ( size_t i = 0; i < procs.size(); ++i )
+            m_where[ procs[i] ] = 1;
+
+        grow( procs, leftCount );
+
+        if ( leftCount > 0 && leftCount < procs.size() )
+        {
+            for ( int pass = 0; pass < m_passes; ++pass )
+                if ( refine( procs, std::min( leftCount, procs.size() - leftCount ) ) <= 0.0 )
+                    break;
+        }
+
+        left.clear();
+        right.clear();
+        for ( size_t i = 0; i < procs.size(); ++i )
+        {
+            ( m_where[ procs[i] ] == 0 ? left : right ).push_back( procs[i] );
+            m_where[ procs[i] ] = -1;
+        }
+    }
+
+    // Greedy graph growing: repeatedly moves to side 0 the rank with the
+    // heaviest connection to what is already there.
+    void grow( const std::vector< int >& procs, size_t leftCount )
+    {
+        for ( size_t i = 0; i < procs.size(); ++i )
+            m_gain[ procs[i] ] = 0.0;
+
+        TGainHeap heap;
+        size_t next = 0;
+        size_t taken = 0;
+        while ( taken < leftCount )
+        {
+            int v = -1;
+            while ( !heap.empty() && v < 0 )
+            {
+                const TGainEntry top = heap.top();
+                heap.pop();
+                if ( m_where[ top.second ] == 1 && top.first == m_gain[ top.second ] )
+                    v = top.second;
+            }
+
+            // Disconnected remainder: start a new region.
+            while ( v < 0 && next < procs.size() )
+            {
+                if ( m_where[ procs[ next ] ] == 1 )
+                    v = procs[ next ];
+                ++next;
+            }
+
+            m_where[v] = 0;
+            ++taken;
+
+            for ( long long e = m_graph.rowPtr[v]; e < m_graph.rowPtr[ v + 1 ]; ++e )
+            {
+                const int u = m_graph.adj[ size_t( e ) ];
+                if ( m_where[u] != 1 )
+                    continue;
+                m_gain[u] += m_graph.weights[ size_t( e ) ];
+                heap.push( TGainEntry( m_gain[u], u ) );
+            }
+        }
+    }
+
+    // One Kernighan-Lin pass. Returns the cut reduction it kept.
+    double refine( const std::vector< int >& procs, size_t maxSwaps )
+    {
+        TGainHeap heaps[2];
+        for ( size_t i = 0; i < procs.size(); ++i )
+        {
+            const int v = procs[i];
+            m_locked[v] = 0;
+            m_gain[v] = externalGain( v );
+            heaps[ m_where[v] ].push( TGainEntry( m_gain[v], v ) );
+        }
+
+        std::vector< std::pair< int, int > > swaps;
+        double total = 0.0;
+        double best = 0.0;
+        size_t bestSwaps = 0;
+        const size_t patience = 64;
+
+        for ( size_t step = 0; step < maxSwaps; ++step )
+        {
+            const int a = popBest( heaps[0] );
+            const int b = popBest( heaps[1] );
+            if ( a < 0 || b < 0 )
+                break;
+
+            total += m_gain[a] + m_gain[b] - 2.0 * edgeWeight( a, b );
+            m_locked[a] = 1;
+            m_locked[b] = 1;
+            move( a, heaps );
+            move( b, heaps );
+            swaps.push_back( std::make_pair( a, b ) );
+
+            if ( total > best + 1e-9 )
+            {
+                best = total;
+                bestSwaps = swaps.size();
+            }
+            else if ( swaps.size() - bestSwaps > patience )
+                break;
+        }
+
+        for ( size_t i = bestSwaps; i < swaps.size(); ++i )
+        {
+            m_where[ swaps[i].first ] = 0;
+            m_where[ swaps[i].second ] = 1;
+        }
+
+        return best;
+    }
+
+    double externalGain( int v ) const
+    {
+        double gain = 0.0;
+        for ( long long e = m_graph.rowPtr[v]; e < m_graph.rowPtr[ v + 1 ]; ++e )
+        {
+            const int u = m_graph.adj[ size_t( e ) ];
+            if ( m_where[u] < 0 )
+                continue;
+            gain += m_where[u] == m_where[v] ? -m_graph.weights[ size_t( e ) ] : m_graph.weights[ size_t( e ) ];
+        }
+        return gain;
+    }
+
+    double edgeWeight( int a, int b ) const
+    {
+        for ( long long e = m_graph.rowPtr[a]; e < m_graph.rowPtr[ a + 1 ]; ++e )
+            if ( m_graph.adj[ size_t( e ) ] == b )
+                return m_graph.weights[ size_t( e ) ];
+        return 0.0;
+    }
+
+    int popBest( TGainHeap& heap )
+    {
+        while ( !heap.empty() )
+        {
+            const TGainEntry top = heap.top();
+            heap.pop();
+            if ( !m_locked[ top.second ] && top.first == m_gain[ top.second ] )
+                return top.second;
+        }
+        return -1;
+    }
+
+    // Moves "v" to the other side and updates the gains of its neighbours.
+    void move( int v, TGainHeap* heaps )
+    {
+        const int from = m_where[v];
+        m_where[v] = 1 - from;
+
+        for ( long long e = m_graph.rowPtr[v]; e < m_graph.rowPtr[ v + 1 ]; ++e )
+        {
+            const int u = m_graph.adj[ size_t( e ) ];
+            if ( m_where[u] < 0 || m_locked[u] )
+                continue;
+
+            const double w = m_graph.weights[ size_t( e ) ];
+            m_gain[u] += m_where[u] == from ? 2.0 * w : -2.0 * w;
+            heaps[ m_where[u] ].push( TGainEntry( m_gain[u], u ) );
+        }
+    }
+
+private:
+    const SCommGraph& m_graph;
+    const DistanceModel& m_dist;
+    std::vector< int > m_where;
+    std::vector< double > m_gain;
+    std::vector< char > m_locked;
+    int m_passes;
+};
+
+//--------------------------------------------------------
+
+// -topo takes a hierarchy or a file written by -discover, -dist any
+// distance file.
+void loadDistanceModel( parparser& args, DistanceModel& dist )
+{
+    const char* topo = args.get( "topo" ).asString(0);
+    const char* distFile = args.get( "dist" ).asString(0);
+    if ( topo && topo[0] )
+    {
+        FILE* fp = fopen( topo, "rb" );
+        if ( fp )
+        {
+            fclose( fp );
+            dist.load( topo );
+        }
+        else
+            dist.parseLevels( topo );
+    }
+    else if ( distFile && distFile[0] )
+        dist.load( distFile );
+    else
+        throw std::string( "Either -topo or -dist must be given. " ).append( __FUNCTION__ );
+}
+
+//--------------------------------------------------------
+
+int mapper_routine( parparser& args )
+{
+    int rank = 0;
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    if ( rank != 0 )
+        return 0;
+
+    try
+    {
+        const char* mtxFile = args.get( "mtx" ).asString(0);
+        const char* outFile = args.get( "o" ).asString(0);
+        if ( !outFile || !outFile[0] )
+            throw std::string( "Invalid mapping file name. " ).append( __FUNCTION__ );
+
+        SCommGraph graph;
+        loadCommGraph( mtxFile, graph );
+
+        DistanceModel dist;
+        loadDistanceModel( args, dist );
+
+        double start = MPI_Wtime();
+        std::vector< int > mapping;
+        RecursiveBisection bisection( graph, dist );
+        bisection.setPasses( args.get( "kl-passes" ).asInt(8) );
+        bisection.run( mapping );
+        double elapsed = MPI_Wtime() - start;
+
+        std::vector< int > identity( graph.size );
+        for ( int i = 0; i < graph.size; ++i )
+            identity[i] = i;
+
+        std::cout << "ranks: " << graph.size << ", edges: " << graph.edges() << ", cores: " << dist.cores() << "\n";
+        std::cout << "hop-bytes identity: " << hopBytes( graph, dist, identity ) << "\n";
+        std::cout << "hop-bytes mapped:   " << hopBytes( graph, dist, mapping ) << "\n";
+        std::cout << "mapping time: " << elapsed << "\n";
+
+        saveMapping( outFile, mapping );
+    }
+    catch( std::string err )
+    {
+        std::cerr << "ERROR OCCURED:\n    " << err << "\n";
+        std::cerr.flush();
+    }
+
+    return 0;
+}
+
+//--------------------------------------------------------
+#endif
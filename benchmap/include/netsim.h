@@ -0,0 +1,815 @@
+#ifndef NETSIM_H
+#define NETSIM_H
+
+#include "parparser.h"
+#include "trace.h"
+#include "program.h"
+#include "mpi.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <utility>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+//--------------------------------------------------------
+
+enum ENetTopology
+{
+    NET_IDEAL     = 0,   // every node has its own NIC links, no fabric
+    NET_FATTREE   = 1,
+    NET_TORUS     = 2,
+    NET_DRAGONFLY = 3
+};
+
+int parseNetTopology( const char* name )
+{
+    if ( !name || !name[0] || 0 == strcmp( "ideal", name ) )
+        return NET_IDEAL;
+    if ( 0 == strcmp( "fattree", name ) )
+        return NET_FATTREE;
+    if ( 0 == strcmp( "torus", name ) )
+        return NET_TORUS;
+    if ( 0 == strcmp( "dragonfly", name ) )
+        return NET_DRAGONFLY;
+    return -1;
+}
+
+//--------------------------------------------------------
+// Times are in microseconds and bandwidths in bytes per microsecond.
+
+struct SNetParams
+{
+    int topology;
+    int ranksPerNode;
+    double linkBw;
+    double linkLat;
+    double memBw;
+    double memLat;
+    double overhead;
+    int eager;
+
+    int ftArity;
+    double ftTaper;
+    std::vector< int > torusDims;
+    int dfRouters;
+    int dfHosts;
+    double dfGlobalBw;
+
+    SNetParams()
+        : topology( NET_IDEAL )
+        , ranksPerNode( 1 )
+        , linkBw( 10000.0 )
+        , linkLat( 0.1 )
+        , memBw( 50000.0 )
+        , memLat( 0.05 )
+        , overhead( 0.5 )
+        , eager( 65536 )
+        , ftArity( 16 )
+        , ftTaper( 1.0 )
+        , dfRouters( 8 )
+        , dfHosts( 4 )
+        , dfGlobalBw( 10000.0 )
+    {}
+};
+
+//--------------------------------------------------------
+// Links with a bandwidth and a busy-until time. A message is pipelined
+// through its route: it enters a link once its head got there and the link
+// is free, holds the link for size / bandwidth, and its tail cannot leave
+// a link before it left the previous one.
+
+class NetworkModel
+{
+public:
+    NetworkModel()
+        : m_topology( NET_IDEAL )
+        , m_nodes( 0 )
+        , m_linkLat( 0.0 )
+        , m_memLat( 0.0 )
+        , m_memBase( 0 )
+        , m_nicBase( 0 )
+        , m_fabricBase( 0 )
+        , m_globalBase( 0 )
+        , m_ftLevels( 0 )
+        , m_dfGroups( 0 )
+    {}
+
+    int links() const { return int( m_busy.size() ); }
+
+    void build( const SNetParams& params, int nodes )
+    {
+        m_params = params;
+        m_topology = params.topology;
+        m_nodes = nodes;
+        m_linkLat = params.linkLat;
+        m_memLat = params.memLat;
+        m_busy.clear();
+        m_bw.clear();
+
+        m_memBase = addLinks( nodes, params.memBw );
+
+        // NIC up and down links of every node.
+        m_nicBase = addLinks( 2 * nodes, params.linkBw );
+
+        if ( m_topology == NET_FATTREE )
+        {
+            if ( params.ftArity < 2 || params.ftTaper <= 0.0 )
+                throw std::string( "Invalid fat tree parameters. " ).append( __FUNCTION__ );
+
+            // Switch uplinks (and downlinks) of every level below the root.
+            m_ftLevels = 1;
+            long long span = params.ftArity;
+            while ( span < nodes )
+            {
+                span *= params.ftArity;
+                ++m_ftLevels;
+            }
+
+            m_ftUp.clear();
+            m_ftDown.clear();
+            m_ftSpan.assign( 1, 1 );
+            double bw = params.linkBw;
+            for ( int l = 1; l < m_ftLevels; ++l )
+            {
+                m_ftSpan.push_back( m_ftSpan.back() * params.ftArity );
+                bw *= params.ftArity / params.ftTaper;
+                const int switches = int( ( nodes + m_ftSpan.back() - 1 ) / m_ftSpan.back() );
+                m_ftUp.push_back( addLinks( switches, bw ) );
+                m_ftDown.push_back( addLinks( switches, bw ) );
+            }
+            m_ftSpan.push_back( m_ftSpan.back() * params.ftArity );
+        }
+        else if ( m_topology == NET_TORUS )
+        {
+            long long total = 1;
+            for ( size_t d = 0; d < params.torusDims.size(); ++d )
+                total *= params.torusDims[d];
+            if ( params.torusDims.empty() || total < nodes )
+                throw std::string( "Torus is smaller than the node count. " ).append( __FUNCTION__ );
+
+            m_fabricBase = addLinks( int( total * params.torusDims.size() * 2 ), params.linkBw );
+        }
+        else if ( m_topology == NET_DRAGONFLY )
+        {
+            if ( params.dfRouters <= 0 || params.dfHosts <= 0 )
+                throw std::string( "Invalid dragonfly parameters. " ).append( __FUNCTION__ );
+
+            const int perGroup = params.dfRouters * params.dfHosts;
+            m_dfGroups = ( nodes + perGroup - 1 ) / perGroup;
+            m_fabricBase = addLinks( m_dfGroups * params.dfRouters * params.dfRouters, params.linkBw );
+            m_globalBase = addLinks( m_dfGroups * m_dfGroups, params.dfGlobalBw );
+        }
+    }
+
+    // Moves "size" bytes from node "src" to node "dst", injected no
+    // earlier than "start". Returns the arrival of the last byte;
+    // "injected" is when the sender's first link is done with it.
+    double transfer( int src, int dst, long long size, double start, double& injected )
+    {
+        route( src, dst );
+        const double lat = src == dst ? m_memLat : m_linkLat;
+
+        double head = start;
+        double tail = start;
+        for ( size_t i = 0; i < m_route.size(); ++i )
+        {
+            const int link = m_route[i];
+            const double begin = std::max( head, m_busy[ link ] );
+            const double end = std::max( begin + size / m_bw[ link ], tail + lat );
+            m_busy[ link ] = end;
+            if ( i == 0 )
+                injected = end;
+            head = begin + lat;
+            tail = end;
+        }
+        return tail + lat;
+    }
+
+private:
+    int addLinks( int count, double bw )
+    {
+        const int base = int( m_busy.size() );
+        m_busy.resize( m_busy.size() + count, 0.0 );
+        m_bw.resize( m_bw.size() + count, bw );
+        return base;
+    }
+
+    void route( int src, int dst )
+    {
+        m_route.clear();
+        if ( src == dst )
+        {
+            m_route.push_back( m_memBase + src );
+            return;
+        }
+
+        m_route.push_back( m_nicBase + 2 * src );
+
+        if ( m_topology == NET_FATTREE )
+        {
+            // Up to the lowest common switch, then down.
+            int top = 1;
+            while ( src / m_ftSpan[ top ] != dst / m_ftSpan[ top ] )
+                ++top;
+            for ( int l = 1; l < top; ++l )
+                m_route.push_back( m_ftUp[ l - 1 ] + int( src / m_ftSpan[l] ) );
+            for ( int l = top - 1; l >= 1; --l )
+                m_route.push_back( m_ftDown[ l - 1 ] + int( dst / m_ftSpan[l] ) );
+        }
+        else if ( m_topology == NET_TORUS )
+        {
+            // Dimension order, the shorter way around each ring.
+            const std::vector< int >& dims = m_params.torusDims;
+            const int dimsNum = int( dims.size() );
+            int cur = src;
+            long long stride = 1;
+            for ( int d = 0; d < dimsNum; ++d )
+            {
+                const int from = int( ( src / stride ) % dims[d] );
+                const int to = int( ( dst / stride ) % dims[d] );
+                const int forward = ( to - from + dims[d] ) % dims[d];
+                const int dir = forward <= dims[d] / 2 ? 0 : 1;
+                const int steps = dir == 0 ? forward : dims[d] - forward;
+
+                int pos = from;
+                for ( int s = 0; s < steps; ++s )
+                {
+                    m_route.push_back( m_fabricBase + ( cur * dimsNum + d ) * 2 + dir );
+                    const int next = dir == 0 ? ( pos + 1 ) % dims[d] : ( pos + dims[d] - 1 ) % dims[d];
+                    cur += int( ( next - pos ) * stride );
+                    pos = next;
+                }
+                stride *= dims[d];
+            }
+        }
+        else if ( m_topology == NET_DRAGONFLY )
+        {
+            // Minimal routing: local hop to the router owning the global
+            // link to the destination group, global hop, local hop.
+            const int a = m_params.dfRouters;
+            const int srcRouter = src / m_params.dfHosts;
+            const int dstRouter = dst / m_params.dfHosts;
+            const int srcGroup = srcRouter / a;
+            const int dstGroup = dstRouter / a;
+
+            if ( srcGroup == dstGroup )
+            {
+                if ( srcRouter != dstRouter )
+                    m_route.push_back( localLink( srcRouter, dstRouter ) );
+            }
+            else
+            {
+                const int out = srcGroup * a + dstGroup % a;
+                const int in = dstGroup * a + srcGroup % a;
+                if ( srcRouter != out )
+                    m_route.push_back( localLink( srcRouter, out ) );
+                m_route.push_back( m_globalBase + srcGroup * m_dfGroups + dstGroup );
+                if ( in != dstRouter )
+                    m_route.push_back( localLink( in, dstRouter ) );
+            }
+        }
+
+        m_route.push_back( m_nicBase + 2 * dst + 1 );
+    }
+
+    int localLink( int from, int to ) const
+    {
+        return m_fabricBase + from * m_params.dfRouters + to % m_params.dfRouters;
+    }
+
+private:
+    SNetParams m_params;
+    int m_topology;
+    int m_nodes;
+    double m_linkLat;
+    double m_memLat;
+
+    std::vector< double > m_busy;
+    std::vector< double > m_bw;
+    std::vector< int > m_route;
+
+    int m_memBase;
+    int m_nicBase;
+    int m_fabricBase;
+    int m_globalBase;
+
+    int m_ftLevels;
+    std::vector< long long > m_ftSpan;
+    std::vector< int > m_ftUp;
+    std::vector< int > m_ftDown;
+
+    int m_dfGroups;
+};
+
+//--------------------------------------------------------
+// 4-ary min-heap of (time, rank). It never holds more than one entry per
+// rank, and the wider nodes halve the depth of a binary heap while
+// keeping the children of a node in one cache line.
+
+class EventQueue
+{
+public:
+    typedef std::pair< double, int > TEvent;
+
+    bool empty() const { return m_heap.empty(); }
+    size_t size() const { return m_heap.size(); }
+    const TEvent& top() const { return m_heap[0]; }
+
+    void push( double time, int rank )
+    {
+        m_heap.push_back( TEvent( time, rank ) );
+        size_t i = m_heap.size() - 1;
+        while ( i > 0 )
+        {
+            const size_t parent = ( i - 1 ) / 4;
+            if ( !( m_heap[i] < m_heap[ parent ] ) )
+                break;
+            std::swap( m_heap[i], m_heap[ parent ] );
+            i = parent;
+        }
+    }
+
+    void pop()
+    {
+        m_heap[0] = m_heap.back();
+        m_heap.pop_back();
+
+        const size_t count = m_heap.size();
+        size_t i = 0;
+        while ( true )
+        {
+            const size_t first = 4 * i + 1;
+            if ( first >= count )
+                break;
+
+            size_t best = first;
+            const size_t last = std::min( first + 4, count );
+            for ( size_t c = first + 1; c < last; ++c )
+                if ( m_heap[c] < m_heap[ best ] )
+                    best = c;
+
+            if ( !( m_heap[ best ] < m_heap[i] ) )
+                break;
+            std::swap( m_heap[i], m_heap[ best ] );
+            i = best;
+        }
+    }
+
+private:
+    std::vector< TEvent > m_heap;
+};
+
+//--------------------------------------------------------
+// Runs the compiled programs of all ranks against a NetworkModel. Sends
+// up to the eager limit leave at once; larger ones wait for the matching
+// receive, like MPI_Send does. Collectives synchronise their members and
+// take an analytic time (binomial trees, pairwise exchange for alltoallv)
+// without loading the links.
+
+class NetSimulator
+{
+public:
+    NetSimulator( const std::vector< SOpProgram >& programs, const STraceHeader& header, const SNetParams& params )
+        : m_programs( programs )
+        , m_params( params )
+        , m_events( 0 )
+    {
+        const int procsNum = int( programs.size() );
+        if ( params.ranksPerNode <= 0 )
+            throw std::string( "Invalid ranks per node. " ).append( __FUNCTION__ );
+        m_network.build( params, ( procsNum + params.ranksPerNode - 1 ) / params.ranksPerNode );
+
+        m_ranks.resize( procsNum );
+        buildMailboxes();
+
+        m_colls.resize( header.commIds.size() + 1 );
+        m_colls[0].members = procsNum;
+        for ( size_t i = 0; i < header.commRanks.size(); ++i )
+        {
+            int members = 0;
+            for ( size_t r = 0; r < header.commRanks[i].size(); ++r )
+                members += header.commRanks[i][r] >= 0 && header.commRanks[i][r] < procsNum;
+            m_colls[ i + 1 ].members = members;
+        }
+    }
+
+    long long events() const { return m_events; }
+
+    // Returns the number of ranks that never finished (unmatched
+    // operations); their completion time is where they got stuck.
+    int run()
+    {
+        for ( int r = 0; r < int( m_ranks.size() ); ++r )
+            m_queue.push( 0.0, r );
+
+        while ( !m_queue.empty() )
+        {
+            const EventQueue::TEvent ev = m_queue.top();
+            m_queue.pop();
+            ++m_events;
+            step( ev.second, ev.first );
+        }
+
+        int stuck = 0;
+        for ( size_t r = 0; r < m_ranks.size(); ++r )
+            stuck += m_ranks[r].state != RANK_DONE;
+        return stuck;
+    }
+
+    double completion( int rank ) const { return m_ranks[ rank ].time; }
+
+private:
+    enum ERankState
+    {
+        RANK_READY,
+        RANK_WAIT_RECV,
+        RANK_WAIT_SEND,
+        RANK_WAIT_COLL,
+        RANK_DONE
+    };
+
+    struct SRankState
+    {
+        size_t pc;
+        int state;
+        double time;
+
+        SRankState()
+            : pc(0)
+            , state( RANK_READY )
+            , time( 0.0 )
+        {}
+    };
+
+    // An eager message with its arrival time, or a pending rendezvous.
+    struct SMessage
+    {
+        double arrival;
+        int size;
+        bool rendezvous;
+    };
+
+    // Messages of one sender to one receiver in send order. The storage is
+    // reused once the queue drains.
+    struct SMailbox
+    {
+        std::vector< SMessage > messages;
+        size_t head;
+
+        SMailbox()
+            : head(0)
+        {}
+
+        bool empty() const { return head == messages.size(); }
+
+        void push( const SMessage& msg ) { messages.push_back( msg ); }
+
+        SMessage pop()
+        {
+            const SMessage msg = messages[ head++ ];
+            if ( head == messages.size() )
+            {
+                messages.clear();
+                head = 0;
+            }
+            return msg;
+        }
+    };
+
+    struct SCollState
+    {
+        int members;
+        int arrived;
+        double latest;
+        std::vector< int > waiting;
+
+        SCollState()
+            : members(0)
+            , arrived(0)
+            , latest( 0.0 )
+        {}
+    };
+
+    int nodeOf( int rank ) const { return rank / m_params.ranksPerNode; }
+
+    // Every receiver gets one mailbox per distinct sender it receives from,
+    // in sender order. m_slots[r][op] is the mailbox a send or receive of
+    // rank r goes through, -1 if the receiver never takes from that sender.
+    void buildMailboxes()
+    {
+        const int procsNum = int( m_programs.size() );
+        std::vector< std::vector< int > > senders( procsNum );
+        for ( int r = 0; r < procsNum; ++r )
+        {
+            const SOpProgram& program = m_programs[r];
+            for ( size_t op = 0; op < program.size(); ++op )
+                if ( program.kinds[ op ] == OP_RECV && program.peers[ op ] >= 0 && program.peers[ op ] < procsNum )
+                    senders[r].push_back( program.peers[ op ] );
+            std::sort( senders[r].begin(), senders[r].end() );
+            senders[r].erase( std::unique( senders[r].begin(), senders[r].end() ), senders[r].end() );
+        }
+
+        m_inbox.resize( procsNum );
+        m_slots.resize( procsNum );
+        for ( int r = 0; r < procsNum; ++r )
+        {
+            m_inbox[r].resize( senders[r].size() );
+
+            const SOpProgram& program = m_programs[r];
+            m_slots[r].assign( program.size(), -1 );
+            for ( size_t op = 0; op < program.size(); ++op )
+            {
+                const int peer = program.peers[ op ];
+                if ( ( program.kinds[ op ] != OP_SEND && program.kinds[ op ] != OP_RECV ) || peer < 0 || peer >= procsNum )
+                    continue;
+
+                const std::vector< int >& list = senders[ program.kinds[ op ] == OP_SEND ? peer : r ];
+                const int sender = program.kinds[ op ] == OP_SEND ? r : peer;
+                std::vector< int >::const_iterator it = std::lower_bound( list.begin(), list.end(), sender );
+                if ( it != list.end() && *it == sender )
+                    m_slots[r][ op ] = int( it - list.begin() );
+            }
+        }
+    }
+
+    void step( int rank, double now )
+    {
+        SRankState& rs = m_ranks[ rank ];
+        const SOpProgram& program = m_programs[ rank ];
+        rs.time = now;
+
+        if ( rs.pc >= program.size() )
+        {
+            rs.state = RANK_DONE;
+            return;
+        }
+
+        const size_t op = rs.pc;
+        if ( !program.times.empty() && program.times[ op ] >= 0.0 && program.times[ op ] * 1e6 > now )
+        {
+            m_queue.push( program.times[ op ] * 1e6, rank );
+            return;
+        }
+
+        const int peer = program.peers[ op ];
+        const int size = program.sizes[ op ];
+        const int slot = m_slots[ rank ][ op ];
+        const double o = m_params.overhead;
+
+        switch ( program.kinds[ op ] )
+        {
+        case OP_SEND:
+            if ( peer < 0 || peer >= int( m_ranks.size() ) )
+                complete( rank, now );
+            else if ( size <= m_params.eager )
+            {
+                double injected = now;
+                SMessage msg;
+                msg.arrival = m_network.transfer( nodeOf( rank ), nodeOf( peer ), size, now + o, injected );
+                msg.size = size;
+                msg.rendezvous = false;
+
+                if ( waitsFor( peer, rank ) )
+                    complete( peer, std::max( m_ranks[ peer ].time, msg.arrival ) + o );
+                else if ( slot >= 0 )
+                    m_inbox[ peer ][ slot ].push( msg );
+                complete( rank, injected );
+            }
+            else if ( waitsFor( peer, rank ) )
+                rendezvous( rank, peer, size, now );
+            else
+            {
+                SMessage msg;
+                msg.arrival = now;
+                msg.size = size;
+                msg.rendezvous = true;
+                if ( slot >= 0 )
+                    m_inbox[ peer ][ slot ].push( msg );
+                rs.state = RANK_WAIT_SEND;
+            }
+            break;
+
+        case OP_RECV:
+            if ( peer < 0 || peer >= int( m_ranks.size() ) )
+                complete( rank, now );
+            else
+            {
+                SMailbox& mailbox = m_inbox[ rank ][ slot ];
+                if ( mailbox.empty() )
+                {
+                    rs.state = RANK_WAIT_RECV;
+                    break;
+                }
+
+                const SMessage msg = mailbox.pop();
+                if ( msg.rendezvous )
+                    rendezvous( peer, rank, msg.size, now );
+                else
+                    complete( rank, std::max( now, msg.arrival ) + o );
+            }
+            break;
+
+        default:
+            {
+                if ( program.kinds[ op ] == OP_MARK && program.tags[ op ] != 'r' )
+                {
+                    complete( rank, now );
+                    break;
+                }
+
+                // A round marker is a free barrier of all ranks.
+                SCollState& coll = m_colls[ program.kinds[ op ] == OP_MARK ? 0 : peer ];
+                rs.state = RANK_WAIT_COLL;
+                coll.waiting.push_back( rank );
+                coll.latest = std::max( coll.latest, now );
+                if ( ++coll.arrived < coll.members )
+                    break;
+
+                const double done = coll.latest + collectiveTime( program.kinds[ op ], size, coll.members );
+                for ( size_t i = 0; i < coll.waiting.size(); ++i )
+                    complete( coll.waiting[i], done );
+                coll.waiting.clear();
+                coll.arrived = 0;
+                coll.latest = 0.0;
+            }
+            break;
+        }
+    }
+
+    bool waitsFor( int rank, int peer )
+    {
+        const SRankState& rs = m_ranks[ rank ];
+        if ( rs.state != RANK_WAIT_RECV || m_programs[ rank ].peers[ rs.pc ] != peer )
+            return false;
+
+        return m_inbox[ rank ][ m_slots[ rank ][ rs.pc ] ].empty();
+    }
+
+    // Both sides are ready: the data moves now and both complete on arrival.
+    void rendezvous( int sender, int receiver, int size, double now )
+    {
+        double injected = now;
+        const double arrival = m_network.transfer( nodeOf( sender ), nodeOf( receiver ), size, now + m_params.overhead, injected );
+        complete( sender, arrival );
+        complete( receiver, arrival + m_params.overhead );
+    }
+
+    // The current operation of "rank" ends at "time"; it resumes after the
+    // operation's delay.
+    void complete( int rank, double time )
+    {
+        SRankState& rs = m_ranks[ rank ];
+        rs.state = RANK_READY;
+        m_queue.push( time + m_programs[ rank ].delays[ rs.pc ], rank );
+        ++rs.pc;
+    }
+
+    double collectiveTime( char kind, int size, int members ) const
+    {
+        if ( kind == OP_MARK )
+            return 0.0;
+
+        int rounds = 0;
+        while ( ( 1 << rounds ) < members )
+            ++rounds;
+
+        const double message = 2.0 * m_params.overhead + 2.0 * m_params.linkLat;
+        const double bytes = double( size ) / m_params.linkBw;
+        if ( kind == OP_ALLREDUCE )
+            return 2.0 * rounds * ( message + bytes );
+        if ( kind == OP_BCAST )
+            return rounds * ( message + bytes );
+        return ( members - 1 ) * ( message + bytes );
+    }
+
+private:
+    const std::vector< SOpProgram >& m_programs;
+    SNetParams m_params;
+    NetworkModel m_network;
+    EventQueue m_queue;
+    std::vector< SRankState > m_ranks;
+    std::vector< std::vector< SMailbox > > m_inbox;
+    std::vector< std::vector< int > > m_slots;
+    std::vector< SCollState > m_colls;
+    long long m_events;
+};
+
+//--------------------------------------------------------
+
+void parseNetParams( parparser& args, SNetParams& params )
+{
+    params.topology = parseNetTopology( args.get( "net" ).asString(0) );
+    if ( params.topology < 0 )
+        throw std::string( "Unknown network topology. " ).append( __FUNCTION__ );
+
+    // Bandwidths are given in GB/s.
+    params.ranksPerNode = args.get( "ranks-per-node" ).asInt( params.ranksPerNode );
+    params.linkBw = args.get( "link-bw" ).asDouble( params.linkBw / 1e3 ) * 1e3;
+    params.linkLat = args.get( "link-lat" ).asDouble( params.linkLat );
+    params.memBw = args.get( "mem-bw" ).asDouble( params.memBw / 1e3 ) * 1e3;
+    params.memLat = args.get( "mem-lat" ).asDouble( params.memLat );
+    params.overhead = args.get( "overhead" ).asDouble( params.overhead );
+    params.eager = args.get( "eager" ).asInt( params.eager );
+    params.ftArity = args.get( "ft-arity" ).asInt( params.ftArity );
+    params.ftTaper = args.get( "ft-taper" ).asDouble( params.ftTaper );
+    params.dfRouters = args.get( "df-routers" ).asInt( params.dfRouters );
+    params.dfHosts = args.get( "df-hosts" ).asInt( params.dfHosts );
+    params.dfGlobalBw = args.get( "df-global-bw" ).asDouble( params.linkBw / 1e3 ) * 1e3;
+
+    if ( params.linkBw <= 0.0 || params.memBw <= 0.0 || params.dfGlobalBw <= 0.0 )
+        throw std::string( "Invalid bandwidth. " ).append( __FUNCTION__ );
+
+    // "8x8x8"
+    const char* dims = args.get( "torus" ).asString( "" );
+    params.torusDims.clear();
+    while ( dims && *dims )
+    {
+        char* next = 0;
+        const int dim = strtol( dims, &next, 10 );
+        if ( next == dims || dim <= 0 )
+            throw std::string( "Invalid torus dimensions. " ).append( __FUNCTION__ );
+        params.torusDims.push_back( dim );
+        dims = *next == 'x' ? next + 1 : next;
+    }
+}
+
+//--------------------------------------------------------
+// Predicts the replay of a trace on a modelled network in one process.
+
+int netsim_routine( parparser& args )
+{
+    int rank = 0;
+    MPI_Comm_rank( MPI_COMM_WORLD, &rank );
+    if ( rank != 0 )
+        return 0;
+
+    try
+    {
+        const char* traceFile = args.get( "t" ).asString(0);
+        if ( !traceFile || !traceFile[0] )
+            throw std::string( "Invalid trace file name. " ).append( __FUNCTION__ );
+
+        SNetParams params;
+        parseNetParams( args, params );
+
+        const double loadStart = MPI_Wtime();
+        TraceReader reader;
+        reader.open( traceFile, MPI_Offset( args.get( "piece-kb" ).asInt( 16 * 1024 ) ) * 1024 );
+        const STraceHeader header = reader.header();
+
+        std::vector< SOpProgram > programs( header.procsNum );
+        std::vector< STraceRecord > records;
+        while ( reader.next( records ) )
+            compilePrograms( records, header, programs );
+        reader.close();
+        std::vector< STraceRecord >().swap( records );
+
+        size_t ops = 0;
+        for ( size_t r = 0; r < programs.size(); ++r )
+            ops += programs[r].size();
+
+        const double simStart = MPI_Wtime();
+        NetSimulator sim( programs, header, params );
+        const int stuck = sim.run();
+        const double simTime = MPI_Wtime() - simStart;
+
+        double slowest = 0.0;
+        double mean = 0.0;
+        for ( int r = 0; r < header.procsNum; ++r )
+        {
+            slowest = std::max( slowest, sim.completion(r) );
+            mean += sim.completion(r) / header.procsNum;
+        }
+
+        std::cout << "ops: " << ops << ", load: " << simStart - loadStart << " s\n";
+        std::cout << "events: " << sim.events() << " in " << simTime << " s ("
+                  << ( simTime > 0.0 ? sim.events() / simTime : 0.0 ) << " per s)\n";
+        std::cout << "predicted time: " << slowest << " us, mean rank: " << mean << " us\n";
+        if ( stuck > 0 )
+            std::cout << "unfinished ranks: " << stuck << "\n";
+
+        const char* outFile = args.get( "o" ).asString(0);
+        if ( outFile && outFile[0] )
+        {
+            FILE* fp = fopen( outFile, "wb" );
+            if ( !fp )
+                throw std::string( "Problems with completion file. " ).append( __FUNCTION__ );
+            for ( int r = 0; r < header.procsNum; ++r )
+                fprintf( fp, "%d %.3f\n", r, sim.completion(r) );
+            fclose( fp );
+        }
+    }
+    catch( std::string err )
+    {
+        std::cerr << "ERROR OCCURED:\n    " << err << "\n";
+        std::cerr.flush();
+    }
+
+    return 0;
+}
+
+//--------------------------------------------------------
+#endif
@@ -0,0 +1,343 @@
+#ifndef PATTERNS_H
+#define PATTERNS_H
+
+#include "rng.h"
+#include "mpi.h"
+
+#include <string>
+#include <vector>
+#include <sstream>
+#include <string.h>
+#include <stdlib.h>
+#include <algorithm>
+
+//--------------------------------------------------------
+
+enum EPattern
+{
+    PATTERN_RANDOM    = 0,   // partition-weighted random pairs
+    PATTERN_STENCIL2D = 1,
+    PATTERN_STENCIL3D = 2,
+    PATTERN_RING      = 3,
+    PATTERN_BUTTERFLY = 4,
+    PATTERN_BINOMIAL  = 5,
+    PATTERN_ALLTOALL  = 6,
+    PATTERN_NEIGHBORS = 7,
+
+    // Permutations: every rank sends once per round, all at the same time.
+    PATTERN_BITREVERSE    = 8,
+    PATTERN_BITCOMPLEMENT = 9,
+    PATTERN_TRANSPOSE     = 10,
+    PATTERN_TORNADO       = 11,
+    PATTERN_SHUFFLE       = 12,
+    PATTERN_RANDPERM      = 13
+};
+
+int parsePattern( const char* name )
+{
+    if ( !name || !name[0] )
+        return -1;
+    if ( 0 == strcmp( "random", name ) )
+        return PATTERN_RANDOM;
+    if ( 0 == strcmp( "stencil2d", name ) )
+        return PATTERN_STENCIL2D;
+    if ( 0 == strcmp( "stencil3d", name ) )
+        return PATTERN_STENCIL3D;
+    if ( 0 == strcmp( "ring", name ) )
+        return PATTERN_RING;
+    if ( 0 == strcmp( "butterfly", name ) )
+        return PATTERN_BUTTERFLY;
+    if ( 0 == strcmp( "binomial", name ) )
+        return PATTERN_BINOMIAL;
+    if ( 0 == strcmp( "alltoall", name ) )
+        return PATTERN_ALLTOALL;
+    if ( 0 == strcmp( "nearest-neighbor", name ) )
+        return PATTERN_NEIGHBORS;
+    if ( 0 == strcmp( "bit-reversal", name ) )
+        return PATTERN_BITREVERSE;
+    if ( 0 == strcmp( "bit-complement", name ) )
+        return PATTERN_BITCOMPLEMENT;
+    if ( 0 == strcmp( "transpose", name ) )
+        return PATTERN_TRANSPOSE;
+    if ( 0 == strcmp( "tornado", name ) )
+        return PATTERN_TORNADO;
+    if ( 0 == strcmp( "shuffle", name ) )
+        return PATTERN_SHUFFLE;
+    if ( 0 == strcmp( "random-permutation", name ) )
+        return PATTERN_RANDPERM;
+    return -1;
+}
+
+bool isPermutationPattern( int kind )
+{
+    return kind >= PATTERN_BITREVERSE && kind <= PATTERN_RANDPERM;
+}
+
+//--------------------------------------------------------
+// One iteration of a structured pattern as a sequence of slots, "stages"
+// slots per rank, enumerated stage by stage. Slot s is rank s % procs in
+// stage s / procs and holds at most one message; pair() computes it on
+// the fly, so even all-to-all on many ranks needs no memory:
+//   stencil2d/3d      - stage per direction (+x, -x, +y, ...) on the grid;
+//   nearest-neighbor  - stage per grid offset in {-1,0,1}^d, diagonals too;
+//   ring              - one stage, i -> i + 1;
+//   butterfly         - stage k: i -> i xor 2^k (recursive doubling);
+//   binomial          - stage k: i -> i + 2^k for i < 2^k (broadcast tree);
+//   alltoall          - stage k: i -> i + k + 1, so every stage is a
+//                       permutation without hot spots.
+// The network stress permutations have a single stage, with b the bits of
+// the largest rank:
+//   bit-reversal      - i -> i with its b bits reversed;
+//   bit-complement    - i -> procs - 1 - i;
+//   transpose         - (r, c) -> (c, r) of an A x B grid;
+//   tornado           - i -> i + ceil(procs / 2) - 1, half way round a ring;
+//   shuffle           - i -> i rotated left by one of b bits;
+//   random-permutation - a new random permutation every iteration.
+// Grid ranks are row-major, the last dimension fastest; without
+// "periodic" the messages that leave the grid are dropped, as are the
+// destinations past the last rank and messages to self.
+
+class CommPattern
+{
+public:
+    CommPattern()
+        : m_kind( PATTERN_RANDOM )
+        , m_procs( 0 )
+        , m_periodic( true )
+        , m_stages( 0 )
+        , m_bits( 0 )
+        , m_messages( 0 )
+    {}
+
+    int kind() const { return m_kind; }
+    bool structured() const { return m_kind != PATTERN_RANDOM; }
+    long long slots() const { return (long long)m_stages * m_procs; }
+    // Messages in one iteration, on average for random-permutation.
+    long long messages() const { return m_messages; }
+    const std::vector< int >& grid() const { return m_grid; }
+
+    // "gridSpec" is "AxB" or "AxBxC"; if empty the grid is chosen by
+    // MPI_Dims_create. Throws if an iteration would hold no message (say
+    // tornado on 2 processes), as it could never add to the volume.
+    void build( int kind, int procs, const std::string& gridSpec, bool periodic )
+    {
+        if ( procs < 2 )
+            throw std::string( "Pattern needs at least 2 processes. " ).append( __FUNCTION__ );
+
+        setup( kind, procs, gridSpec, periodic );
+
+        // A random permutation has one fixed point on average.
+        m_messages = m_kind == PATTERN_RANDPERM ? procs - 1 : countMessages();
+        if ( m_kind != PATTERN_RANDOM && m_messages == 0 )
+            throw std::string( "Pattern has no messages for this process number. " ).append( __FUNCTION__ );
+    }
+
+    // Called before every iteration; draws the next random permutation.
+    void nextIteration( Rng& rng )
+    {
+        for ( int i = int( m_perm.size() ) - 1; i > 0; --i )
+            std::swap( m_perm[i], m_perm[ size_t( rng.below( uint64_t( i ) + 1 ) ) ] );
+    }
+
+    // False if the slot holds no message.
+    bool pair( long long slot, int& from, int& to ) const
+    {
+        const int stage = int( slot / m_procs );
+        from = int( slot % m_procs );
+
+        switch ( m_kind )
+        {
+        case PATTERN_RING:
+            to = ( from + 1 ) % m_procs;
+            return true;
+        case PATTERN_BUTTERFLY:
+            to = from ^ ( 1 << stage );
+            return to < m_procs;
+        case PATTERN_BINOMIAL:
+            to = from + ( 1 << stage );
+            return from < ( 1 << stage ) && to < m_procs;
+        case PATTERN_ALLTOALL:
+            to = ( from + stage + 1 ) % m_procs;
+            return true;
+        case PATTERN_BITREVERSE:
+            to = 0;
+            for ( int b = 0; b < m_bits; ++b )
+                to |= ( ( from >> b ) & 1 ) << ( m_bits - 1 - b );
+            return to < m_procs && to != from;
+        case PATTERN_BITCOMPLEMENT:
+            to = m_procs - 1 - from;
+            return to != from;
+        case PATTERN_TRANSPOSE:
+            to = from % m_grid[1] * m_grid[0] + from / m_grid[1];
+            return to != from;
+        case PATTERN_TORNADO:
+            to = ( from + ( m_procs + 1 ) / 2 - 1 ) % m_procs;
+            return to != from;
+        case PATTERN_SHUFFLE:
+            to = ( ( from << 1 ) | ( from >> ( m_bits - 1 ) ) ) & ( ( 1 << m_bits ) - 1 );
+            return to < m_procs && to != from;
+        case PATTERN_RANDPERM:
+            to = m_perm[ from ];
+            return to != from;
+        default:
+            return gridNeighbor( from, m_offsets[ stage ], to ) && to != from;
+        }
+    }
+
+private:
+    void setup( int kind, int procs, const std::string& gridSpec, bool periodic )
+    {
+        m_kind = kind;
+        m_procs = procs;
+        m_periodic = periodic;
+        m_grid.clear();
+        m_offsets.clear();
+        m_perm.clear();
+
+        m_bits = 0;
+        while ( ( 1 << m_bits ) < procs )
+            ++m_bits;
+
+        switch ( kind )
+        {
+        case PATTERN_RANDOM:
+            m_stages = 0;
+            return;
+        case PATTERN_RING:
+            m_stages = 1;
+            return;
+        case PATTERN_BUTTERFLY:
+        case PATTERN_BINOMIAL:
+            m_stages = m_bits;
+            return;
+        case PATTERN_ALLTOALL:
+            m_stages = procs - 1;
+            return;
+        case PATTERN_BITREVERSE:
+        case PATTERN_BITCOMPLEMENT:
+        case PATTERN_TORNADO:
+        case PATTERN_SHUFFLE:
+            m_stages = 1;
+            return;
+        case PATTERN_RANDPERM:
+            m_stages = 1;
+            m_perm.resize( procs );
+            for ( int i = 0; i < procs; ++i )
+                m_perm[i] = i;
+            return;
+        case PATTERN_TRANSPOSE:
+            m_stages = 1;
+            parseGrid( gridSpec, 2, 2 );
+            return;
+        case PATTERN_STENCIL2D:
+        case PATTERN_STENCIL3D:
+        case PATTERN_NEIGHBORS:
+            break;
+        default:
+            throw std::string( "Unknown pattern. " ).append( __FUNCTION__ );
+        }
+
+        parseGrid( gridSpec, kind == PATTERN_STENCIL3D ? 3 : kind == PATTERN_STENCIL2D ? 2 : 0, 1 );
+        const int dims = int( m_grid.size() );
+
+        if ( kind == PATTERN_NEIGHBORS )
+        {
+            int count = 1;
+            for ( int d = 0; d < dims; ++d )
+                count *= 3;
+            for ( int code = 0; code < count; ++code )
+            {
+                std::vector< int > offset( dims );
+                bool zero = true;
+                for ( int d = 0, rest = code; d < dims; ++d, rest /= 3 )
+                {
+                    offset[d] = rest % 3 - 1;
+                    zero = zero && offset[d] == 0;
+                }
+                if ( !zero )
+                    m_offsets.push_back( offset );
+            }
+        }
+        else
+        {
+            for ( int d = 0; d < dims; ++d )
+            {
+                for ( int dir = 1; dir >= -1; dir -= 2 )
+                {
+                    m_offsets.push_back( std::vector< int >( dims, 0 ) );
+                    m_offsets.back()[d] = dir;
+                }
+            }
+        }
+        m_stages = int( m_offsets.size() );
+    }
+
+    long long countMessages() const
+    {
+        int from = 0;
+        int to = 0;
+        long long count = 0;
+        for ( long long slot = 0; slot < slots(); ++slot )
+            if ( pair( slot, from, to ) )
+                ++count;
+        return count;
+    }
+
+    // Every side of the grid must be at least "minSide".
+    void parseGrid( const std::string& spec, int dims, int minSide )
+    {
+        if ( spec.empty() )
+        {
+            m_grid.assign( dims > 0 ? dims : 2, 0 );
+            MPI_Dims_create( m_procs, int( m_grid.size() ), &m_grid[0] );
+        }
+        else
+        {
+            std::stringstream parts( spec );
+            std::string part;
+            while ( std::getline( parts, part, 'x' ) )
+                m_grid.push_back( atoi( part.c_str() ) );
+        }
+
+        long long product = 1;
+        for ( size_t d = 0; d < m_grid.size(); ++d )
+            product *= m_grid[d] >= minSide ? m_grid[d] : 0;
+
+        if ( ( dims > 0 && int( m_grid.size() ) != dims ) || m_grid.size() < 2 || m_grid.size() > 3 || product != m_procs )
+            throw std::string( "Invalid process grid. " ).append( __FUNCTION__ );
+    }
+
+    bool gridNeighbor( int rank, const std::vector< int >& offset, int& neighbor ) const
+    {
+        neighbor = 0;
+        int stride = 1;
+        for ( int d = int( m_grid.size() ) - 1; d >= 0; --d )
+        {
+            int coord = rank / stride % m_grid[d] + offset[d];
+            if ( coord < 0 || coord >= m_grid[d] )
+            {
+                if ( !m_periodic )
+                    return false;
+                coord = ( coord + m_grid[d] ) % m_grid[d];
+            }
+            neighbor += coord * stride;
+            stride *= m_grid[d];
+        }
+        return true;
+    }
+
+private:
+    int m_kind;
+    int m_procs;
+    bool m_periodic;
+    int m_stages;
+    int m_bits;
+    long long m_messages;
+
+    std::vector< int > m_grid;
+    std::vector< std::vector< int > > m_offsets;
+    std::vector< int > m_perm;
+};
+
+//--------------------------------------------------------
+#endif
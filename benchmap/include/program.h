@@ -0,0 +1,184 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "trace.h"
+
+#include <vector>
+#include <algorithm>
+
+//--------------------------------------------------------
+
+enum EOpKind
+{
+    OP_SEND      = 0,
+    OP_RECV      = 1,
+    OP_ALLREDUCE = 2,
+    OP_BCAST     = 3,
+    OP_ALLTOALLV = 4,
+    OP_MARK      = 5
+};
+
+bool isCollectiveOp( char kind )
+{
+    return kind >= OP_ALLREDUCE && kind <= OP_ALLTOALLV;
+}
+
+//--------------------------------------------------------
+// Operations of a single rank, stored as parallel arrays so that the replay
+// loop only touches the fields it needs. "delays" is the pause after each
+// operation in microseconds. For collectives "peers" holds the
+// communicator slot (see STraceHeader::commSlot) and "tags" the root, for
+// markers "peers" holds the interval index and "tags" the record kind.
+// "times" holds the issue times in seconds (negative if none) and is
+// only filled if at least one record of the rank has a timestamp.
+
+struct SOpProgram
+{
+    std::vector< char > kinds;
+    std::vector< int > peers;
+    std::vector< int > sizes;
+    std::vector< int > tags;
+    std::vector< int > delays;
+    std::vector< double > times;
+
+    size_t size() const { return kinds.size(); }
+
+    // Largest point-to-point message, which sizes the replay buffer.
+    int maxMessageSize() const
+    {
+        int maxSize = 0;
+        for ( size_t op = 0; op < kinds.size(); ++op )
+            if ( !isCollectiveOp( kinds[ op ] ) && sizes[ op ] > maxSize )
+                maxSize = sizes[ op ];
+        return maxSize;
+    }
+
+    void reserve( size_t count )
+    {
+        kinds.reserve( count );
+        peers.reserve( count );
+        sizes.reserve( count );
+        tags.reserve( count );
+        delays.reserve( count );
+    }
+
+    void push( char kind, int peer, int size, int tag, int delay )
+    {
+        kinds.push_back( kind );
+        peers.push_back( peer );
+        sizes.push_back( size );
+        tags.push_back( tag );
+        delays.push_back( delay );
+    }
+};
+
+//--------------------------------------------------------
+
+char collectiveOpKind( char recordKind )
+{
+    return recordKind == 'a' ? OP_ALLREDUCE : recordKind == 'b' ? OP_BCAST : OP_ALLTOALLV;
+}
+
+// Appends an operation; "times" is started at the first timestamp and
+// backfilled with -1 for the operations before it.
+void pushTracedOp( SOpProgram& program, char kind, int peer, int size, int tag, int delay, double timeUs )
+{
+    program.push( kind, peer, size, tag, delay );
+    if ( timeUs >= 0.0 || !program.times.empty() )
+    {
+        program.times.resize( program.size() - 1, -1.0 );
+        program.times.push_back( timeUs >= 0.0 ? timeUs * 1e-6 : -1.0 );
+    }
+}
+
+//--------------------------------------------------------
+
+void compileProgram( const std::vector< STraceRecord >& records, const STraceHeader& header, int rank, SOpProgram& program )
+{
+    program.reserve( records.size() );
+
+    const int defaultDelayUs = header.defaultDelayUs();
+
+    std::vector< char > member( header.commIds.size() + 1, 0 );
+    member[0] = rank < header.procsNum;
+    for ( size_t i = 0; i < header.commRanks.size(); ++i )
+        member[ i + 1 ] = std::find( header.commRanks[i].begin(), header.commRanks[i].end(), rank ) != header.commRanks[i].end();
+
+    for ( size_t i = 0; i < records.size(); ++i )
+    {
+        const STraceRecord& rec = records[i];
+        const int delay = rec.delay >= 0 ? rec.delay : defaultDelayUs;
+
+        if ( isCollectiveKind( rec.kind ) )
+        {
+            const int slot = header.commSlot( rec.from );
+            if ( slot < 0 || !member[ slot ] )
+                continue;
+
+            pushTracedOp( program, collectiveOpKind( rec.kind ), slot, rec.size, rec.to, delay, rec.time );
+        }
+        else if ( isMarkerKind( rec.kind ) )
+        {
+            if ( member[0] )
+                pushTracedOp( program, OP_MARK, rec.from, 0, rec.kind, 0, rec.time );
+        }
+        else if ( rec.kind == 's' )
+        {
+            if ( rank == rec.from )
+                pushTracedOp( program, OP_SEND, rec.to, rec.size, rec.from, delay, rec.time );
+            else if ( rank == rec.to )
+                pushTracedOp( program, OP_RECV, rec.from, rec.size, rec.from, delay, rec.time );
+        }
+    }
+}
+
+//--------------------------------------------------------
+// Appends the operations of "records" to the programs of all ranks below
+// header.procsNum at once, for tools that run every rank in one process.
+
+void compilePrograms( const std::vector< STraceRecord >& records, const STraceHeader& header, std::vector< SOpProgram >& programs )
+{
+    const int procsNum = header.procsNum;
+    programs.resize( procsNum );
+
+    const int defaultDelayUs = header.defaultDelayUs();
+
+    for ( size_t i = 0; i < records.size(); ++i )
+    {
+        const STraceRecord& rec = records[i];
+        const int delay = rec.delay >= 0 ? rec.delay : defaultDelayUs;
+
+        if ( isCollectiveKind( rec.kind ) )
+        {
+            const int slot = header.commSlot( rec.from );
+            const char kind = collectiveOpKind( rec.kind );
+            if ( slot == 0 )
+            {
+                for ( int r = 0; r < procsNum; ++r )
+                    pushTracedOp( programs[r], kind, slot, rec.size, rec.to, delay, rec.time );
+            }
+            else if ( slot > 0 )
+            {
+                const std::vector< int >& ranks = header.commRanks[ slot - 1 ];
+                for ( size_t r = 0; r < ranks.size(); ++r )
+                    if ( ranks[r] >= 0 && ranks[r] < procsNum )
+                        pushTracedOp( programs[ ranks[r] ], kind, slot, rec.size, rec.to, delay, rec.time );
+            }
+        }
+        else if ( isMarkerKind( rec.kind ) )
+        {
+            for ( int r = 0; r < procsNum; ++r )
+                pushTracedOp( programs[r], OP_MARK, rec.from, 0, rec.kind, 0, rec.time );
+        }
+        else if ( rec.kind == 's' )
+        {
+            if ( rec.from >= 0 && rec.from < procsNum )
+                pushTracedOp( programs[ rec.from ], OP_SEND, rec.to, rec.size, rec.from, delay, rec.time );
+            if ( rec.to >= 0 && rec.to < procsNum )
+                pushTracedOp( programs[ rec.to ], OP_RECV, rec.from, rec.size, rec.from, delay, rec.time );
+        }
+    }
+}
+
+//--------------------------------------------------------
+#endif
@@ -0,0 +1,395 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include "program.h"
+#include "histogram.h"
+#include "commstats.h"
+#include "delay.h"
+#include "mpi.h"
+
+#include <vector>
+#include <algorithm>
+
+//--------------------------------------------------------
+
+class RequestWindow;
+struct SCollectiveBuffers;
+
+// "colls" holds a communicator per slot of STraceHeader::commSlot,
+// MPI_COMM_NULL where this rank is not a member. With a "scheduler" the
+// windowed engine issues timestamped operations at
+// startTime + time * dilation (local clock). With "marks" the time every
+// marker is passed is appended to it.
+// The buffers are built by the caller before the first run and reused by
+// every run: "buf" by the blocking engine, "requests" by the windowed one
+// and "collBufs" by both.
+struct SReplayContext
+{
+    MPI_Comm comm;
+    const std::vector< MPI_Comm >* colls;
+    int rank;
+    int bufSize;
+    int window;
+    DelayEngine* delay;
+    LatencyHistogram* hist;
+    PeerStats* peerStats;
+    DelayEngine* scheduler;
+    double startTime;
+    double dilation;
+    std::vector< double >* marks;
+    std::vector< char >* buf;
+    RequestWindow* requests;
+    SCollectiveBuffers* collBufs;
+};
+
+//--------------------------------------------------------
+
+bool recordsLatency( const SReplayContext& ctx )
+{
+    return ctx.hist || ctx.peerStats;
+}
+
+// Collectives have no single peer and are passed with peer == -1.
+void recordOp( const SReplayContext& ctx, int peer, int size, double seconds )
+{
+    if ( ctx.hist )
+        ctx.hist->add( size, seconds );
+    if ( ctx.peerStats && peer >= 0 )
+        ctx.peerStats->add( peer, size, seconds );
+}
+
+//--------------------------------------------------------
+// Builds a communicator for every "%comm" of the trace out of "comm"
+// (slot 0 is "comm" itself). Every rank of "comm" must call it.
+
+void createTraceComms( MPI_Comm comm, const STraceHeader& header, std::vector< MPI_Comm >& colls )
+{
+    int rank = 0;
+    MPI_Comm_rank( comm, &rank );
+
+    colls.assign( 1, comm );
+    for ( size_t i = 0; i < header.commRanks.size(); ++i )
+    {
+        const std::vector< int >& ranks = header.commRanks[i];
+        const std::vector< int >::const_iterator found = std::find( ranks.begin(), ranks.end(), rank );
+        const int color = found != ranks.end() ? 0 : MPI_UNDEFINED;
+        const int key = int( found - ranks.begin() );
+
+        MPI_Comm sub = MPI_COMM_NULL;
+        MPI_Comm_split( comm, color, key, &sub );
+        colls.push_back( sub );
+    }
+}
+
+void freeTraceComms( std::vector< MPI_Comm >& colls )
+{
+    for ( size_t i = 1; i < colls.size(); ++i )
+        if ( colls[i] != MPI_COMM_NULL )
+            MPI_Comm_free( &colls[i] );
+    colls.clear();
+}
+
+//--------------------------------------------------------
+// Buffers large enough for every collective of a program.
+
+struct SCollectiveBuffers
+{
+    std::vector< char > send;
+    std::vector< char > recv;
+    std::vector< int > counts;
+    std::vector< int > displs;
+
+    void prepare( const SOpProgram& program, const std::vector< MPI_Comm >& colls )
+    {
+        size_t maxBytes = 1;
+        int maxMembers = 1;
+        for ( size_t op = 0; op < program.size(); ++op )
+        {
+            if ( !isCollectiveOp( program.kinds[ op ] ) )
+                continue;
+
+            int members = 1;
+            MPI_Comm_size( colls[ program.peers[ op ] ], &members );
+            if ( members > maxMembers )
+                maxMembers = members;
+
+            size_t bytes = size_t( program.sizes[ op ] );
+            if ( program.kinds[ op ] == OP_ALLTOALLV )
+                bytes *= members;
+            if ( bytes > maxBytes )
+                maxBytes = bytes;
+        }
+
+        send.resize( maxBytes );
+        recv.resize( maxBytes );
+        counts.resize( maxMembers );
+        displs.resize( maxMembers );
+    }
+};
+
+void replayCollective( const SOpProgram& program, size_t op, const SReplayContext& ctx, SCollectiveBuffers& bufs )
+{
+    MPI_Comm comm = (*ctx.colls)[ program.peers[ op ] ];
+    const int size = program.sizes[ op ];
+
+    switch ( program.kinds[ op ] )
+    {
+    case OP_ALLREDUCE:
+        MPI_Allreduce( &bufs.send[0], &bufs.recv[0], size, MPI_BYTE, MPI_BOR, comm );
+        break;
+    case OP_BCAST:
+        MPI_Bcast( &bufs.send[0], size, MPI_BYTE, program.tags[ op ], comm );
+        break;
+    case OP_ALLTOALLV:
+        {
+            int members = 1;
+            MPI_Comm_size( comm, &members );
+            for ( int i = 0; i < members; ++i )
+            {
+                bufs.counts[i] = size;
+                bufs.displs[i] = i * size;
+            }
+            MPI_Alltoallv( &bufs.send[0], &bufs.counts[0], &bufs.displs[0], MPI_BYTE,
+                           &bufs.recv[0], &bufs.counts[0], &bufs.displs[0], MPI_BYTE, comm );
+        }
+        break;
+    }
+}
+
+//--------------------------------------------------------
+// A round marker waits for all ranks, so that rounds do not overlap.
+
+void replayMark( const SOpProgram& program, size_t op, const SReplayContext& ctx )
+{
+    if ( program.tags[ op ] == 'r' )
+        MPI_Barrier( ctx.comm );
+    if ( ctx.marks )
+        ctx.marks->push_back( MPI_Wtime() );
+}
+
+//--------------------------------------------------------
+
+// Lock-step replay: every operation is a blocking MPI_Send/MPI_Recv.
+
+void replayBlocking( const SOpProgram& program, const SReplayContext& ctx )
+{
+    std::vector< char >& buf = *ctx.buf;
+    MPI_Status status;
+
+    const bool timed = recordsLatency( ctx );
+    const size_t opsNum = program.size();
+    for ( size_t op = 0; op < opsNum; ++op )
+    {
+        const double opStart = timed ? MPI_Wtime() : 0.0;
+        const char kind = program.kinds[ op ];
+
+        if ( kind == OP_SEND )
+            MPI_Send( &buf[0], program.sizes[ op ], MPI_CHAR, program.peers[ op ], program.tags[ op ], ctx.comm );
+        else if ( kind == OP_RECV )
+            MPI_Recv( &buf[0], program.sizes[ op ], MPI_CHAR, program.peers[ op ], program.tags[ op ], ctx.comm, &status );
+        else if ( kind == OP_MARK )
+        {
+            replayMark( program, op, ctx );
+            continue;
+        }
+        else
+            replayCollective( program, op, ctx, *ctx.collBufs );
+
+        if ( timed )
+            recordOp( ctx, isCollectiveOp( kind ) ? -1 : program.peers[ op ], program.sizes[ op ], MPI_Wtime() - opStart );
+
+        ctx.delay->wait( program.delays[ op ] );
+    }
+}
+
+//--------------------------------------------------------
+// Requests in flight of the windowed replay. Every slot owns its own
+// receive buffer, while all sends share one read-only buffer.
+
+class RequestWindow
+{
+public:
+    RequestWindow( int window, size_t slotSize )
+        : m_slotSize( slotSize )
+        , m_sendBuf( slotSize )
+        , m_recvBufs( slotSize * window )
+        , m_requests( window, MPI_REQUEST_NULL )
+        , m_completed( window )
+        , m_postTimes( window )
+        , m_sizes( window )
+        , m_peers( window )
+    {
+        for ( int i = 0; i < window; ++i )
+            m_freeSlots.push_back( window - 1 - i );
+    }
+
+    bool full() const { return m_freeSlots.empty(); }
+    bool empty() const { return m_freeSlots.size() == m_requests.size(); }
+
+    void post( const SOpProgram& program, size_t op, const SReplayContext& ctx, bool timed )
+    {
+        const int slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+
+        if ( timed )
+        {
+            m_postTimes[ slot ] = MPI_Wtime();
+            m_sizes[ slot ] = program.sizes[ op ];
+            m_peers[ slot ] = program.peers[ op ];
+        }
+
+        if ( program.kinds[ op ] == OP_SEND )
+            MPI_Isend( &m_sendBuf[0], program.sizes[ op ], MPI_CHAR, program.peers[ op ], program.tags[ op ],
+                       ctx.comm, &m_requests[ slot ] );
+        else
+            MPI_Irecv( &m_recvBufs[ slot * m_slotSize ], program.sizes[ op ], MPI_CHAR, program.peers[ op ],
+                       program.tags[ op ], ctx.comm, &m_requests[ slot ] );
+    }
+
+    void waitSome( const SReplayContext& ctx, bool timed )
+    {
+        int completedNum = 0;
+        MPI_Waitsome( int( m_requests.size() ), &m_requests[0], &completedNum, &m_completed[0], MPI_STATUSES_IGNORE );
+        complete( ctx, timed, completedNum );
+    }
+
+    void testSome( const SReplayContext& ctx, bool timed )
+    {
+        int completedNum = 0;
+        MPI_Testsome( int( m_requests.size() ), &m_requests[0], &completedNum, &m_completed[0], MPI_STATUSES_IGNORE );
+        complete( ctx, timed, completedNum );
+    }
+
+    void drain( const SReplayContext& ctx, bool timed )
+    {
+        while ( !empty() )
+            waitSome( ctx, timed );
+    }
+
+private:
+    void complete( const SReplayContext& ctx, bool timed, int completedNum )
+    {
+        if ( completedNum == MPI_UNDEFINED )
+            return;
+
+        const double now = timed ? MPI_Wtime() : 0.0;
+        for ( int i = 0; i < completedNum; ++i )
+        {
+            const int done = m_completed[i];
+            m_freeSlots.push_back( done );
+            if ( timed )
+                recordOp( ctx, m_peers[ done ], m_sizes[ done ], now - m_postTimes[ done ] );
+        }
+    }
+
+private:
+    size_t m_slotSize;
+    std::vector< char > m_sendBuf;
+    std::vector< char > m_recvBufs;
+    std::vector< MPI_Request > m_requests;
+    std::vector< int > m_completed;
+    std::vector< int > m_freeSlots;
+    std::vector< double > m_postTimes;
+    std::vector< int > m_sizes;
+    std::vector< int > m_peers;
+};
+
+//--------------------------------------------------------
+// Runs a delay of "us" microseconds while the requests in flight are
+// polled, so their completions are stamped when they happen rather than
+// after the delay. Compute delays are polled only before and after.
+
+void waitPolling( RequestWindow& window, int us, const SReplayContext& ctx, bool timed )
+{
+    if ( us <= 0 )
+        return;
+
+    if ( !ctx.delay->timeBased() )
+    {
+        window.testSome( ctx, timed );
+        ctx.delay->wait( us );
+        window.testSome( ctx, timed );
+        return;
+    }
+
+    const double deadline = MPI_Wtime() + us * 1e-6;
+    double now = MPI_Wtime();
+    while ( now < deadline && !window.empty() )
+    {
+        window.testSome( ctx, timed );
+        now = MPI_Wtime();
+    }
+    if ( now < deadline )
+        ctx.delay->wait( int( ( deadline - now ) * 1e6 + 0.5 ) );
+}
+
+//--------------------------------------------------------
+// Up to "window" operations of the rank are kept in flight with
+// MPI_Isend/MPI_Irecv; a new one is posted as soon as MPI_Waitsome frees a
+// slot. Operations are posted in program order, so MPI's non-overtaking
+// rule keeps the per-pair order of the trace. The latency of an operation
+// is the time from posting to observed completion; the requests are
+// polled after every post and during delays, so completion is observed
+// soon after it happens. A collective or a marker first completes
+// everything in flight and then runs as a blocking call.
+//
+// In scheduled mode every timestamped operation waits for its issue time;
+// the wait keeps polling the requests in flight so they make progress, and
+// the per-record delays are skipped since the timestamps already contain
+// the compute gaps.
+
+void replayWindowed( const SOpProgram& program, const SReplayContext& ctx )
+{
+    RequestWindow& window = *ctx.requests;
+
+    const bool timed = recordsLatency( ctx );
+    const bool scheduled = ctx.scheduler && !program.times.empty();
+    const size_t opsNum = program.size();
+    for ( size_t op = 0; op < opsNum; ++op )
+    {
+        if ( scheduled && program.times[ op ] >= 0.0 )
+        {
+            const double deadline = ctx.startTime + program.times[ op ] * ctx.dilation;
+            while ( MPI_Wtime() < deadline )
+            {
+                if ( window.empty() )
+                {
+                    ctx.scheduler->waitUntil( deadline );
+                    break;
+                }
+                window.testSome( ctx, timed );
+            }
+        }
+
+        if ( program.kinds[ op ] == OP_MARK )
+        {
+            window.drain( ctx, timed );
+            replayMark( program, op, ctx );
+            continue;
+        }
+        else if ( isCollectiveOp( program.kinds[ op ] ) )
+        {
+            window.drain( ctx, timed );
+
+            const double opStart = timed ? MPI_Wtime() : 0.0;
+            replayCollective( program, op, ctx, *ctx.collBufs );
+            if ( timed )
+                recordOp( ctx, -1, program.sizes[ op ], MPI_Wtime() - opStart );
+        }
+        else
+        {
+            if ( window.full() )
+                window.waitSome( ctx, timed );
+            window.post( program, op, ctx, timed );
+            window.testSome( ctx, timed );
+        }
+
+        if ( !scheduled || program.times[ op ] < 0.0 )
+            waitPolling( window, program.delays[ op ], ctx, timed );
+    }
+
+    window.drain( ctx, timed );
+}
+
+//--------------------------------------------------------
+#endif
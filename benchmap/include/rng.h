@@ -0,0 +1,84 @@
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+//--------------------------------------------------------
+// xoshiro256** (Blackman, Vigna). The state is seeded through splitmix64.
+// Independent streams of one seed are counter based: Rng( seed, stream )
+// seeds with the seed and the mixed stream index, so stream n costs nothing
+// to reach and any rank can start any stream on its own.
+// The output depends only on the seed, on every platform.
+
+class Rng
+{
+public:
+    explicit Rng( uint64_t seed = 0 ) { reseed( seed ); }
+    Rng( uint64_t seed, uint64_t stream ) { reseed( seed ^ mix( stream + 0x9e3779b97f4a7c15ULL ) ); }
+
+    void reseed( uint64_t seed )
+    {
+        for ( int i = 0; i < 4; ++i )
+        {
+            seed += 0x9e3779b97f4a7c15ULL;
+            m_s[i] = mix( seed );
+        }
+    }
+
+    uint64_t next()
+    {
+        const uint64_t result = rotl( m_s[1] * 5, 7 ) * 9;
+        const uint64_t t = m_s[1] << 17;
+
+        m_s[2] ^= m_s[0];
+        m_s[3] ^= m_s[1];
+        m_s[1] ^= m_s[2];
+        m_s[0] ^= m_s[3];
+        m_s[2] ^= t;
+        m_s[3] = rotl( m_s[3], 45 );
+
+        return result;
+    }
+
+    // Uniform in [0, 1) with 53 bits of resolution.
+    double uniform()
+    {
+        return double( next() >> 11 ) * ( 1.0 / 9007199254740992.0 );
+    }
+
+    // Uniform in [0, bound) without modulo bias: draws below 2^64 mod
+    // bound are rejected, so every residue is equally likely.
+    uint64_t below( uint64_t bound )
+    {
+        if ( bound <= 1 )
+            return 0;
+
+        const uint64_t threshold = ( 0 - bound ) % bound;
+        while ( true )
+        {
+            const uint64_t r = next();
+            if ( r >= threshold )
+                return r % bound;
+        }
+    }
+
+private:
+    // The splitmix64 output function.
+    static uint64_t mix( uint64_t z )
+    {
+        z = ( z ^ ( z >> 30 ) ) * 0xbf58476d1ce4e5b9ULL;
+        z = ( z ^ ( z >> 27 ) ) * 0x94d049bb133111ebULL;
+        return z ^ ( z >> 31 );
+    }
+
+    static uint64_t rotl( uint64_t x, int k )
+    {
+        return ( x << k ) | ( x >> ( 64 - k ) );
+    }
+
+private:
+    uint64_t m_s[4];
+};
+
+//--------------------------------------------------------
+#endif
@@ -0,0 +1,83 @@
+#ifndef RUNSTATS_H
+#define RUNSTATS_H
+
+#include <vector>
+#include <algorithm>
+#include <iostream>
+#include <math.h>
+
+//--------------------------------------------------------
+
+struct SRunSummary
+{
+    int runs;
+    double min;
+    double max;
+    double median;
+    double mean;
+    double stddev;
+    double ci95;
+};
+
+//--------------------------------------------------------
+// Two-sided 95% quantile of Student's t distribution for "df" degrees of
+// freedom; the normal quantile is used past the end of the table.
+
+double studentT95( int df )
+{
+    static const double table[] =
+    {
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+        2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+        2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    static const int tableSize = sizeof(table) / sizeof(table[0]);
+
+    if ( df <= 0 )
+        return 0.0;
+    return df <= tableSize ? table[ df - 1 ] : 1.960;
+}
+
+//--------------------------------------------------------
+
+SRunSummary summarizeRuns( std::vector< double > times )
+{
+    SRunSummary summary = SRunSummary();
+    summary.runs = int( times.size() );
+    if ( times.empty() )
+        return summary;
+
+    std::sort( times.begin(), times.end() );
+    const size_t n = times.size();
+
+    summary.min = times.front();
+    summary.max = times.back();
+    summary.median = n % 2 ? times[ n / 2 ] : 0.5 * ( times[ n / 2 - 1 ] + times[ n / 2 ] );
+
+    double sum = 0.0;
+    for ( size_t i = 0; i < n; ++i )
+        sum += times[i];
+    summary.mean = sum / n;
+
+    double sqSum = 0.0;
+    for ( size_t i = 0; i < n; ++i )
+        sqSum += ( times[i] - summary.mean ) * ( times[i] - summary.mean );
+    summary.stddev = n > 1 ? sqrt( sqSum / ( n - 1 ) ) : 0.0;
+    summary.ci95 = n > 1 ? studentT95( int( n - 1 ) ) * summary.stddev / sqrt( double( n ) ) : 0.0;
+
+    return summary;
+}
+
+void printRunSummary( std::ostream& out, const SRunSummary& summary )
+{
+    out << "runs:   " << summary.runs << "\n";
+    out << "min:    " << summary.min << "\n";
+    out << "median: " << summary.median << "\n";
+    out << "mean:   " << summary.mean << "\n";
+    out << "stddev: " << summary.stddev << "\n";
+    out << "ci95:   " << summary.mean - summary.ci95 << " .. " << summary.mean + summary.ci95 << "\n";
+    out << "max:    " << summary.max << "\n";
+}
+
+//--------------------------------------------------------
+#endif
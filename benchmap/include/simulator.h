@@ -2,17 +2,69 @@
 #define SIMULATOR_H
 
 #include "parparser.h"
+#include "trace.h"
+#include "program.h"
+#include "replay.h"
+#include "runstats.h"
+#include "clocksync.h"
+#include "mapping.h"
+#include "topology.h"
 #include <string>
 #include <sstream>
-#include <time.h>
-#include <stdlib.h>
-
-#ifdef _MSC_VER
-    #define WIN32_LEAN_AND_MEAN
-    #include <Windows.h>
-#else
-    #include <unistd.h>
-#endif
+#include <vector>
+
+//--------------------------------------------------------
+// Prints every marked interval of a run: it lasts from its marker to the
+// next marker of the same kind or the next phase marker (or to "endTime")
+// on the slowest rank, and its bandwidth is the point-to-point bytes all
+// ranks sent in it over that time.
+
+void reportIntervals( MPI_Comm comm, const SOpProgram& program, const std::vector< double >& marks, double endTime, std::ostream& out )
+{
+    int rank = 0;
+    MPI_Comm_rank( comm, &rank );
+
+    // Bytes sent between a marker and the next one.
+    std::vector< size_t > markOps;
+    std::vector< double > segmentBytes( marks.size(), 0.0 );
+    for ( size_t op = 0; op < program.size(); ++op )
+    {
+        if ( program.kinds[ op ] == OP_MARK )
+            markOps.push_back( op );
+        else if ( program.kinds[ op ] == OP_SEND && !markOps.empty() && markOps.size() <= segmentBytes.size() )
+            segmentBytes[ markOps.size() - 1 ] += program.sizes[ op ];
+    }
+    if ( markOps.size() != marks.size() || marks.empty() )
+        return;
+
+    std::vector< double > seconds( marks.size() );
+    std::vector< double > bytes( marks.size(), 0.0 );
+    for ( size_t i = 0; i < marks.size(); ++i )
+    {
+        const char kind = char( program.tags[ markOps[i] ] );
+        size_t end = i + 1;
+        while ( end < marks.size() && program.tags[ markOps[ end ] ] != kind && program.tags[ markOps[ end ] ] != 'p' )
+            ++end;
+
+        seconds[i] = ( end < marks.size() ? marks[ end ] : endTime ) - marks[i];
+        for ( size_t j = i; j < end; ++j )
+            bytes[i] += segmentBytes[j];
+    }
+
+    std::vector< double > totalSeconds( marks.size() );
+    std::vector< double > totalBytes( marks.size() );
+    MPI_Reduce( &seconds[0], &totalSeconds[0], int( marks.size() ), MPI_DOUBLE, MPI_MAX, 0, comm );
+    MPI_Reduce( &bytes[0], &totalBytes[0], int( marks.size() ), MPI_DOUBLE, MPI_SUM, 0, comm );
+    if ( rank != 0 )
+        return;
+
+    for ( size_t i = 0; i < marks.size(); ++i )
+    {
+        const size_t op = markOps[i];
+        out << ( program.tags[ op ] == 'p' ? "phase " : "round " ) << program.peers[ op ] << ": " << totalSeconds[i] << " s, " << (long long)totalBytes[i] << " bytes, "
+            << ( totalSeconds[i] > 0.0 ? totalBytes[i] / totalSeconds[i] / 1e6 : 0.0 ) << " MB/s\n";
+    }
+}
 
 //--------------------------------------------------------
 
@@ -24,122 +76,194 @@ int simulator_routine( parparser& args )
         int commSize = 0;
         MPI_Comm_rank( MPI_COMM_WORLD, &rank );
         MPI_Comm_size( MPI_COMM_WORLD, &commSize );
-    
-        srand( unsigned( time(0) ) );
+
+        const char* topoFile = args.get( "discover-topo" ).asString(0);
+        if ( topoFile && topoFile[0] )
+            writeTopology( MPI_COMM_WORLD, topoFile, args.get( "topo-costs" ).asString(0) );
 
         const char* traceFile = args.get( "t" ).asString(0);
         if ( !traceFile || !traceFile[0] )
             throw std::string( "Invalid trace file name. " ).append( __FUNCTION__ );   
 
-        MPI_File fp = MPI_FILE_NULL;
-        MPI_File_open( MPI_COMM_WORLD, const_cast<char*>(traceFile), MPI_MODE_RDONLY, MPI_INFO_NULL, &fp );
-    
-        MPI_Offset fileSize = 0;
-        MPI_File_get_size( fp, &fileSize );
-    
-        std::string trace;
-        trace.resize( unsigned(fileSize) );
-
-        MPI_Status status;    
-        MPI_File_read_at_all( fp, 0, &trace[0], int( fileSize ), MPI_CHAR, &status );
-        MPI_File_close( &fp );
-
-        std::stringstream sStr( trace );
-        std::string line;
-        line.resize(1024);
-        char symb;
-
-        int bufSize = 0;
-        int procsNum = 0;
-        int sleepTime = 0;
-
-        do
-        {                
-            sStr >> symb;
-            sStr.getline( &line[0], 1024 );
-
-            if ( symb == '#' ) 
-                continue;
-            else if ( symb == '%' )
-            {
-                if ( line.find("transfer_buf") != std::string::npos )
-                    bufSize = strtol( &line[ strlen("transfer_buf") + 2 ], 0, 10 );
-                else if ( line.find("procs_num") != std::string::npos )
-                    procsNum = strtol( &line[ strlen("procs_num") + 2 ], 0, 10 );
-                else if ( line.find("sleep") != std::string::npos )
-                    sleepTime = strtol( &line[ strlen("sleep") + 2 ], 0, 10 );
-            }
-        } while (symb != '-');
+        const MPI_Offset pieceSize = MPI_Offset( args.get( "piece-kb" ).asInt( 16 * 1024 ) ) * 1024;
+        if ( pieceSize <= 0 )
+            throw std::string( "Invalid piece size. " ).append( __FUNCTION__ );
+
+        // With -map, trace rank r is replayed by world rank placement[r], so
+        // the same trace can be run under any placement.
+        const char* mapFile = args.get( "map" ).asString(0);
+        std::vector< int > placement;
+        if ( mapFile && mapFile[0] )
+            readMapping( mapFile, placement );
+        const int traceRank = placement.empty() ? rank : placedTraceRank( placement, commSize, rank );
+
+        STraceHeader header;
+        std::vector< STraceRecord > records;
+        loadTracePartitioned( MPI_COMM_WORLD, traceFile, pieceSize, header, records, placement.empty() ? 0 : &placement );
+
+        const int procsNum = header.procsNum;
 
         if ( commSize < procsNum )
             throw std::string( "Too small communicator. " ).append( __FUNCTION__ );
+        if ( !placement.empty() && int( placement.size() ) != procsNum )
+            throw std::string( "Mapping does not match the trace. " ).append( __FUNCTION__ );
 
-        if ( rank >= procsNum )
+        MPI_Comm replayComm = MPI_COMM_NULL;
+        const bool replays = traceRank >= 0 && traceRank < procsNum;
+        MPI_Comm_split( MPI_COMM_WORLD, replays ? 0 : MPI_UNDEFINED, traceRank, &replayComm );
+        if ( replayComm == MPI_COMM_NULL )
             return 0;
 
-        int from = 0;
-        int to = 0;
-        int dataSize = 0;
-        char* buf = new char[ bufSize ];
-        bool needSleep = false;
-
-        double startTime = MPI_Wtime();
+        SOpProgram program;
+        compileProgram( records, header, traceRank, program );
+        std::vector< STraceRecord >().swap( records );
 
-        int lineNum = 0;
+        // Sized by the program rather than the header's transfer_buf, which
+        // older traces set to the average message size.
+        const int bufSize = program.maxMessageSize();
 
-        while ( !sStr.eof() )
+        if ( traceRank == 0 )
         {
-            sStr >> symb;
+            std::cout << "ops: " << program.size() << "\r\n";
+            std::cout.flush();
+        }
+
+        const std::string mode = args.get( "mode" ).asString( "blocking" );
+        if ( mode != "blocking" && mode != "window" && mode != "timed" )
+            throw std::string( "Unknown replay mode. " ).append( __FUNCTION__ );
+
+        const char* delayModeArg = args.get( "delay-mode" ).asString(0);
+        int delayMode = delayModeArg ? parseDelayMode( delayModeArg ) : header.delayMode;
+        if ( delayModeArg && delayMode < 0 )
+            throw std::string( "Unknown delay mode. " ).append( __FUNCTION__ );
+        if ( delayMode < 0 )
+            delayMode = DELAY_SLEEP;
 
-            if ( lineNum % 500 == 0 && rank == 0 )
+        std::vector< MPI_Comm > colls;
+        createTraceComms( replayComm, header, colls );
+
+        DelayEngine delay( delayMode );
+
+        const bool collectHist = args.get( "hist" ).asBool( false );
+        LatencyHistogram hist;
+
+        const char* measuredMtxFile = args.get( "mmtx" ).asString(0);
+        const bool collectPeers = measuredMtxFile && measuredMtxFile[0];
+        PeerStats peerStats;
+
+        const bool timedMode = mode == "timed";
+        DelayEngine scheduler( timedMode ? DELAY_HYBRID : DELAY_SPIN );
+        const double clockOffset = timedMode ? estimateClockOffset( replayComm, args.get( "sync-rounds" ).asInt( 10 ) ) : 0.0;
+
+        SReplayContext ctx;
+        ctx.comm = replayComm;
+        ctx.colls = &colls;
+        ctx.rank = traceRank;
+        ctx.bufSize = bufSize;
+        ctx.window = args.get( "window" ).asInt( 64 );
+        ctx.delay = &delay;
+        ctx.hist = collectHist ? &hist : 0;
+        ctx.peerStats = collectPeers ? &peerStats : 0;
+        ctx.scheduler = timedMode ? &scheduler : 0;
+        ctx.startTime = 0.0;
+        ctx.dilation = args.get( "dilation" ).asDouble( 1.0 );
+        ctx.marks = 0;
+
+        if ( ctx.window <= 0 )
+            throw std::string( "Invalid window size. " ).append( __FUNCTION__ );
+        if ( ctx.dilation < 0.0 )
+            throw std::string( "Invalid time dilation. " ).append( __FUNCTION__ );
+
+        // Allocated and touched here, outside the measured runs; only the
+        // engine in use gets full-size buffers.
+        const bool blocking = mode == "blocking";
+        const size_t slotSize = bufSize > 0 ? size_t( bufSize ) : 1;
+        std::vector< char > buf( blocking ? slotSize : 1 );
+        RequestWindow requests( blocking ? 1 : ctx.window, blocking ? 1 : slotSize );
+
+        SCollectiveBuffers collBufs;
+        collBufs.prepare( program, colls );
+
+        ctx.buf = &buf;
+        ctx.requests = &requests;
+        ctx.collBufs = &collBufs;
+
+        const int warmup = args.get( "warmup" ).asInt( 0 );
+        const int reps = args.get( "reps" ).asInt( 1 );
+        if ( warmup < 0 || reps <= 0 )
+            throw std::string( "Invalid repetitions number. " ).append( __FUNCTION__ );
+
+        // Warm-up runs pay connection setup and page faults and are not
+        // recorded anywhere. Every run starts from a barrier (in timed mode
+        // from a common point of the synchronized clocks) and its time is
+        // the slowest rank's.
+        // Marked intervals are reported for the last run.
+        std::vector< double > times;
+        std::vector< double > marks;
+        double endTime = 0.0;
+        for ( int run = 0; run < warmup + reps; ++run )
+        {
+            SReplayContext runCtx = ctx;
+            if ( run < warmup )
             {
-                std::cout << lineNum << "\r\n";
-                std::cout.flush();
+                runCtx.hist = 0;
+                runCtx.peerStats = 0;
             }
-        
-            ++lineNum;
+            if ( run == warmup + reps - 1 )
+                runCtx.marks = &marks;
 
-            if ( symb == 's' )
-            {
-                sStr >> from;
-                sStr >> to;
-                sStr >> dataSize;
-
-                if ( rank == from )
-                {
-                    MPI_Send( buf, dataSize, MPI_CHAR, to, from, MPI_COMM_WORLD );
-                    needSleep = true;
-                }
-                else if ( rank == to )
-                {              
-                    MPI_Recv( buf, dataSize, MPI_CHAR, from, from, MPI_COMM_WORLD, &status ); 
-                    needSleep = true;
-                }
-
-                if ( needSleep )
-                {
-                    needSleep = false;
-                    if ( sleepTime > 0 )
-                    #ifdef _MSC_VER
-                         Sleep( sleepTime );
-                    #else
-                        usleep( sleepTime * 1000 );
-                    #endif
-                }
-            } 
-            else if ( symb == '#' )
+            MPI_Barrier( replayComm );
+            if ( timedMode )
             {
-                sStr.getline( &line[0], 1024 );
-                continue;
+                runCtx.startTime = synchronizedStart( replayComm, clockOffset, 0.01 );
+                scheduler.waitUntil( runCtx.startTime );
             }
+            const double startTime = timedMode ? runCtx.startTime : MPI_Wtime();
+
+            if ( blocking )
+                replayBlocking( program, runCtx );
+            else
+                replayWindowed( program, runCtx );
+
+            endTime = MPI_Wtime();
+            const double runTime = endTime - startTime;
+            double totalTime = 0.0;
+            MPI_Reduce( const_cast<double*>( &runTime ), &totalTime, 1, MPI_DOUBLE, MPI_MAX, 0, replayComm );
+
+            if ( run >= warmup )
+                times.push_back( totalTime );
         }
 
-        double totalTime = MPI_Wtime() - startTime;
+        if ( traceRank == 0 )
+        {
+            if ( reps == 1 )
+                std::cout << times[0];
+            else
+                printRunSummary( std::cout, summarizeRuns( times ) );
+        }
+
+        if ( !marks.empty() )
+        {
+            if ( traceRank == 0 )
+                std::cout << "\n";
+            reportIntervals( replayComm, program, marks, endTime, std::cout );
+        }
+
+        if ( collectHist )
+        {
+            hist.reduce( replayComm, 0 );
+            if ( traceRank == 0 )
+            {
+                std::cout << "\n";
+                hist.print( std::cout );
+            }
+        }
 
-        if ( rank == 0 )
-            std::cout << totalTime;
+        if ( collectPeers )
+            peerStats.save( replayComm, measuredMtxFile, args.get( "mmtx-metric" ).asString( "bw" ) );
 
-        delete[] buf;
+        freeTraceComms( colls );
+        MPI_Comm_free( &replayComm );
     }
     catch( std::string err )
     {        
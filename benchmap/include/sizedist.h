@@ -0,0 +1,240 @@
+#ifndef SIZEDIST_H
+#define SIZEDIST_H
+
+#include "rng.h"
+#include "alias.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+#pragma warning(disable : 4996)
+
+//--------------------------------------------------------
+
+enum ESizeDist
+{
+    SIZE_CONSTANT  = 0,
+    SIZE_UNIFORM   = 1,
+    SIZE_LOGNORMAL = 2,
+    SIZE_BIMODAL   = 3,
+    SIZE_EMPIRICAL = 4
+};
+
+int parseSizeDist( const char* name )
+{
+    if ( !name )
+        return -1;
+    if ( 0 == strcmp( name, "constant" ) )
+        return SIZE_CONSTANT;
+    if ( 0 == strcmp( name, "uniform" ) )
+        return SIZE_UNIFORM;
+    if ( 0 == strcmp( name, "lognormal" ) )
+        return SIZE_LOGNORMAL;
+    if ( 0 == strcmp( name, "bimodal" ) )
+        return SIZE_BIMODAL;
+    if ( 0 == strcmp( name, "empirical" ) )
+        return SIZE_EMPIRICAL;
+    return -1;
+}
+
+//--------------------------------------------------------
+// Message size distribution, sampled once per message:
+//   constant   - always "a" bytes, without drawing from the stream;
+//   uniform    - uniform in [a, b];
+//   lognormal  - median "a", shape "sigma", cut at "b" bytes;
+//   bimodal    - "b" bytes with probability "p", "a" bytes otherwise;
+//   empirical  - the sizes of a histogram, weighted by their counts.
+// Samples are never below 1 byte.
+
+class SizeDistribution
+{
+public:
+    // Default cut of the lognormal tail.
+    enum { MAX_SIZE = 1 << 30 };
+
+    SizeDistribution()
+        : m_kind( SIZE_CONSTANT )
+        , m_a( 0 )
+        , m_b( 0 )
+        , m_sigma( 0.0 )
+        , m_p( 0.0 )
+        , m_mean( 0.0 )
+    {}
+
+    int kind() const { return m_kind; }
+
+    void constant( int size )
+    {
+        if ( size <= 0 )
+            throw std::string( "Invalid size distribution. " ).append( __FUNCTION__ );
+        m_kind = SIZE_CONSTANT;
+        m_a = size;
+    }
+
+    void uniform( int minSize, int maxSize )
+    {
+        if ( minSize <= 0 || maxSize < minSize )
+            throw std::string( "Invalid size distribution. " ).append( __FUNCTION__ );
+        m_kind = SIZE_UNIFORM;
+        m_a = minSize;
+        m_b = maxSize;
+    }
+
+    void lognormal( int median, double sigma, int maxSize )
+    {
+        if ( median <= 0 || sigma < 0.0 || maxSize < median )
+            throw std::string( "Invalid size distribution. " ).append( __FUNCTION__ );
+        m_kind = SIZE_LOGNORMAL;
+        m_a = median;
+        m_b = maxSize;
+        m_sigma = sigma;
+    }
+
+    void bimodal( int smallSize, int largeSize, double pLarge )
+    {
+        if ( smallSize <= 0 || largeSize <= 0 || pLarge < 0.0 || pLarge > 1.0 )
+            throw std::string( "Invalid size distribution. " ).append( __FUNCTION__ );
+        m_kind = SIZE_BIMODAL;
+        m_a = smallSize;
+        m_b = largeSize;
+        m_p = pLarge;
+    }
+
+    void empirical( const std::vector< int >& sizes, const std::vector< double >& weights )
+    {
+        if ( sizes.empty() || sizes.size() != weights.size() )
+            throw std::string( "Invalid size distribution. " ).append( __FUNCTION__ );
+        for ( size_t i = 0; i < sizes.size(); ++i )
+            if ( sizes[i] <= 0 || weights[i] < 0.0 )
+                throw std::string( "Invalid size distribution. " ).append( __FUNCTION__ );
+
+        m_kind = SIZE_EMPIRICAL;
+        m_sizes = sizes;
+        m_table.build( weights );
+
+        double total = 0.0;
+        m_mean = 0.0;
+        for ( size_t i = 0; i < sizes.size(); ++i )
+        {
+            m_mean += sizes[i] * weights[i];
+            total += weights[i];
+        }
+        m_mean /= total;
+    }
+
+    // "size count" lines; empty lines and lines starting with '#' are
+    // skipped.
+    void loadHistogram( const char* fileName )
+    {
+        if ( !fileName || !fileName[0] )
+            throw std::string( "Invalid size histogram file name. " ).append( __FUNCTION__ );
+
+        FILE* fp = fopen( fileName, "rb" );
+        if ( !fp )
+            throw std::string( "Problems with size histogram file. " ).append( __FUNCTION__ );
+
+        std::vector< int > sizes;
+        std::vector< double > weights;
+        char line[256];
+        while ( fgets( line, sizeof(line), fp ) )
+        {
+            if ( line[0] == '#' )
+                continue;
+
+            int size = 0;
+            double weight = 0.0;
+            const int fields = sscanf( line, "%d %lf", &size, &weight );
+            if ( fields <= 0 )
+                continue;
+            if ( fields != 2 || size <= 0 || weight < 0.0 )
+            {
+                fclose( fp );
+                throw std::string( "Invalid size histogram line. " ).append( __FUNCTION__ );
+            }
+
+            sizes.push_back( size );
+            weights.push_back( weight );
+        }
+        fclose( fp );
+
+        empirical( sizes, weights );
+    }
+
+    int sample( Rng& rng ) const
+    {
+        switch ( m_kind )
+        {
+        case SIZE_UNIFORM:
+            return m_a + int( rng.below( uint64_t( m_b - m_a ) + 1 ) );
+        case SIZE_LOGNORMAL:
+        {
+            // Box-Muller; 1 - u keeps the logarithm finite.
+            const double u1 = 1.0 - rng.uniform();
+            const double u2 = rng.uniform();
+            const double z = sqrt( -2.0 * log( u1 ) ) * cos( 6.283185307179586 * u2 );
+            const double size = floor( m_a * exp( m_sigma * z ) + 0.5 );
+            return size < 1.0 ? 1 : size > m_b ? m_b : int( size );
+        }
+        case SIZE_BIMODAL:
+            return rng.uniform() < m_p ? m_b : m_a;
+        case SIZE_EMPIRICAL:
+            return m_sizes[ m_table.sample( rng ) ];
+        default:
+            return m_a;
+        }
+    }
+
+    // No sample is larger.
+    int maxSize() const
+    {
+        switch ( m_kind )
+        {
+        case SIZE_UNIFORM:
+        case SIZE_LOGNORMAL:
+            return m_b;
+        case SIZE_BIMODAL:
+            return std::max( m_a, m_b );
+        case SIZE_EMPIRICAL:
+            return *std::max_element( m_sizes.begin(), m_sizes.end() );
+        default:
+            return m_a;
+        }
+    }
+
+    // Expected sample; for lognormal that of the uncut distribution,
+    // capped at the cut.
+    double mean() const
+    {
+        switch ( m_kind )
+        {
+        case SIZE_UNIFORM:
+            return 0.5 * ( double( m_a ) + m_b );
+        case SIZE_LOGNORMAL:
+            return std::min( m_a * exp( 0.5 * m_sigma * m_sigma ), double( m_b ) );
+        case SIZE_BIMODAL:
+            return m_p * m_b + ( 1.0 - m_p ) * m_a;
+        case SIZE_EMPIRICAL:
+            return m_mean;
+        default:
+            return m_a;
+        }
+    }
+
+private:
+    int m_kind;
+    int m_a;
+    int m_b;
+    double m_sigma;
+    double m_p;
+    double m_mean;
+
+    std::vector< int > m_sizes;
+    AliasTable m_table;
+};
+
+//--------------------------------------------------------
+#endif
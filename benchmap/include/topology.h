@@ -0,0 +1,399 @@
+#ifndef TOPOLOGY_H
+#define TOPOLOGY_H
+
+#include "parparser.h"
+#include "mpi.h"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <set>
+#include <stdio.h>
+#include <stdlib.h>
+
+#ifdef _MSC_VER
+    #ifndef WIN32_LEAN_AND_MEAN
+        #define WIN32_LEAN_AND_MEAN
+    #endif
+    #include <Windows.h>
+#else
+    #include <sched.h>
+    #include <dirent.h>
+#endif
+
+#pragma warning(disable : 4996)
+
+//--------------------------------------------------------
+// Where a rank runs. The fields go from the outermost level inwards and
+// each is only meaningful within the ones before it, so the distance of
+// two ranks is decided by the first field they differ in. Levels the
+// rank is not bound to get an id of its own (negative), so it is never
+// taken to share them with another rank. "cpu" is -1 unless the rank is
+// bound to a single cpu.
+
+enum ETopoLevel
+{
+    TOPO_NODE    = 0,
+    TOPO_PACKAGE = 1,
+    TOPO_NUMA    = 2,
+    TOPO_CORE    = 3,
+    TOPO_LEVELS  = 4
+};
+
+struct STopoPlace
+{
+    int ids[ TOPO_LEVELS ];
+    int cpu;
+};
+
+//--------------------------------------------------------
+
+struct STopoCosts
+{
+    // Cost of differing at each level; "shared" is for two ranks on one
+    // core (hardware threads or oversubscription).
+    double level[ TOPO_LEVELS ];
+    double shared;
+
+    STopoCosts()
+    {
+        level[ TOPO_NODE ] = 10.0;
+        level[ TOPO_PACKAGE ] = 4.0;
+        level[ TOPO_NUMA ] = 3.0;
+        level[ TOPO_CORE ] = 2.0;
+        shared = 1.0;
+    }
+
+    // "node,package,numa,core,shared"
+    void parse( const char* spec )
+    {
+        const char* cur = spec;
+        for ( int i = 0; i <= TOPO_LEVELS; ++i )
+        {
+            char* next = 0;
+            const double value = strtod( cur, &next );
+            if ( next == cur || ( i < TOPO_LEVELS && *next != ',' ) )
+                throw std::string( "Invalid topology costs. " ).append( __FUNCTION__ );
+
+            ( i < TOPO_LEVELS ? level[i] : shared ) = value;
+            cur = next + 1;
+        }
+    }
+
+    double distance( const STopoPlace& a, const STopoPlace& b ) const
+    {
+        for ( int l = 0; l < TOPO_LEVELS; ++l )
+            if ( a.ids[l] != b.ids[l] )
+                return level[l];
+        return shared;
+    }
+};
+
+//--------------------------------------------------------
+
+int readSysfsInt( const char* path, int def )
+{
+    FILE* fp = fopen( path, "rb" );
+    if ( !fp )
+        return def;
+
+    int value = def;
+    if ( 1 != fscanf( fp, "%d", &value ) )
+        value = def;
+    fclose( fp );
+    return value;
+}
+
+// Package, NUMA node and core of "cpu".
+void readCpuPlace( int cpu, STopoPlace& place )
+{
+    for ( int l = 0; l < TOPO_LEVELS; ++l )
+        place.ids[l] = 0;
+    place.cpu = cpu;
+
+#ifdef _MSC_VER
+    place.ids[ TOPO_CORE ] = cpu;
+#else
+    char path[256];
+    sprintf( path, "/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu );
+    place.ids[ TOPO_PACKAGE ] = readSysfsInt( path, 0 );
+    sprintf( path, "/sys/devices/system/cpu/cpu%d/topology/core_id", cpu );
+    place.ids[ TOPO_CORE ] = readSysfsInt( path, cpu );
+
+    sprintf( path, "/sys/devices/system/cpu/cpu%d", cpu );
+    DIR* dir = opendir( path );
+    if ( dir )
+    {
+        dirent* entry = 0;
+        while ( ( entry = readdir( dir ) ) != 0 )
+        {
+            int node = 0;
+            if ( 1 == sscanf( entry->d_name, "node%d", &node ) )
+            {
+                place.ids[ TOPO_NUMA ] = node;
+                break;
+            }
+        }
+        closedir( dir );
+    }
+#endif
+}
+
+// Package, NUMA node and core the calling process is bound to, from its
+// affinity mask rather than from the cpu it happens to run on. A level is
+// known only if all allowed cpus share it; unknown levels are -1, as is
+// "cpu" unless exactly one cpu is allowed.
+void discoverLocalPlace( STopoPlace& place )
+{
+    for ( int l = 0; l < TOPO_LEVELS; ++l )
+        place.ids[l] = l == TOPO_NODE ? 0 : -1;
+    place.cpu = -1;
+
+    std::vector< int > cpus;
+#ifdef _MSC_VER
+    DWORD_PTR processMask = 0;
+    DWORD_PTR systemMask = 0;
+    if ( GetProcessAffinityMask( GetCurrentProcess(), &processMask, &systemMask ) )
+        for ( int cpu = 0; cpu < int( 8 * sizeof(processMask) ); ++cpu )
+            if ( processMask & ( DWORD_PTR(1) << cpu ) )
+                cpus.push_back( cpu );
+#else
+    cpu_set_t mask;
+    CPU_ZERO( &mask );
+    if ( 0 == sched_getaffinity( 0, sizeof(mask), &mask ) )
+        for ( int cpu = 0; cpu < CPU_SETSIZE; ++cpu )
+            if ( CPU_ISSET( cpu, &mask ) )
+                cpus.push_back( cpu );
+#endif
+
+    for ( size_t i = 0; i < cpus.size(); ++i )
+    {
+        STopoPlace cpuPlace;
+        readCpuPlace( cpus[i], cpuPlace );
+        if ( i == 0 )
+        {
+            place = cpuPlace;
+            continue;
+        }
+
+        place.cpu = -1;
+        bool same = true;
+        for ( int l = TOPO_PACKAGE; l < TOPO_LEVELS; ++l )
+        {
+            same = same && place.ids[l] == cpuPlace.ids[l];
+            if ( !same )
+                place.ids[l] = -1;
+        }
+    }
+}
+
+//--------------------------------------------------------
+// Gathers the place of every rank of "comm" on "root". Nodes are told
+// apart by MPI_COMM_TYPE_SHARED and numbered by their lowest rank.
+
+void discoverTopology( MPI_Comm comm, int root, std::vector< STopoPlace >& places, std::vector< std::string >& nodeNames )
+{
+    int rank = 0;
+    int commSize = 0;
+    MPI_Comm_rank( comm, &rank );
+    MPI_Comm_size( comm, &commSize );
+
+    MPI_Comm nodeComm = MPI_COMM_NULL;
+    MPI_Comm_split_type( comm, MPI_COMM_TYPE_SHARED, rank, MPI_INFO_NULL, &nodeComm );
+    int nodeLeader = rank;
+    MPI_Bcast( &nodeLeader, 1, MPI_INT, 0, nodeComm );
+    MPI_Comm_free( &nodeComm );
+
+    STopoPlace local;
+    discoverLocalPlace( local );
+    local.ids[ TOPO_NODE ] = nodeLeader;
+    for ( int l = TOPO_PACKAGE; l < TOPO_LEVELS; ++l )
+        if ( local.ids[l] < 0 )
+            local.ids[l] = -1 - rank;
+
+    int localData[ TOPO_LEVELS + 1 ];
+    for ( int l = 0; l < TOPO_LEVELS; ++l )
+        localData[l] = local.ids[l];
+    localData[ TOPO_LEVELS ] = local.cpu;
+
+    char name[ MPI_MAX_PROCESSOR_NAME + 1 ] = { 0 };
+    int nameLen = 0;
+    MPI_Get_processor_name( name, &nameLen );
+
+    std::vector< int > allData( rank == root ? commSize * ( TOPO_LEVELS + 1 ) : 1 );
+    std::vector< char > allNames( rank == root ? commSize * ( MPI_MAX_PROCESSOR_NAME + 1 ) : 1 );
+    MPI_Gather( localData, TOPO_LEVELS + 1, MPI_INT, &allData[0], TOPO_LEVELS + 1, MPI_INT, root, comm );
+    MPI_Gather( name, MPI_MAX_PROCESSOR_NAME + 1, MPI_CHAR, &allNames[0], MPI_MAX_PROCESSOR_NAME + 1, MPI_CHAR, root, comm );
+
+    places.clear();
+    nodeNames.clear();
+    if ( rank != root )
+        return;
+
+    places.resize( commSize );
+    nodeNames.resize( commSize );
+    for ( int r = 0; r < commSize; ++r )
+    {
+        const int* data = &allData[ r * ( TOPO_LEVELS + 1 ) ];
+        for ( int l = 0; l < TOPO_LEVELS; ++l )
+            places[r].ids[l] = data[l];
+        places[r].cpu = data[ TOPO_LEVELS ];
+        nodeNames[r] = &allNames[ r * ( MPI_MAX_PROCESSOR_NAME + 1 ) ];
+    }
+}
+
+//--------------------------------------------------------
+// If every level is split into contiguous, equally sized groups of ranks,
+// the topology can be given to the mapper as a compact "-topo" string.
+// Returns an empty string otherwise.
+
+bool sameGroup( const STopoPlace& a, const STopoPlace& b, int level )
+{
+    if ( level >= TOPO_LEVELS )
+        return false;
+    for ( int l = 0; l <= level; ++l )
+        if ( a.ids[l] != b.ids[l] )
+            return false;
+    return true;
+}
+
+std::string regularTopoSpec( const std::vector< STopoPlace >& places, const STopoCosts& costs )
+{
+    const int size = int( places.size() );
+    std::string spec;
+    int parentGroups = 1;
+
+    for ( int l = 0; l <= TOPO_LEVELS; ++l )
+    {
+        // Level TOPO_LEVELS splits a core into its ranks.
+        int groups = 1;
+        for ( int r = 1; r < size; ++r )
+            groups += !sameGroup( places[r], places[ r - 1 ], l );
+
+        if ( groups % parentGroups != 0 || size % groups != 0 )
+            return std::string();
+
+        // Equal group sizes: every group must start at a multiple of the
+        // size, and no group may come back after another one.
+        const int groupSize = size / groups;
+        std::set< std::vector< int > > seen;
+        for ( int r = 0; r < size; ++r )
+        {
+            const bool starts = r == 0 || !sameGroup( places[r], places[ r - 1 ], l );
+            if ( starts != ( r % groupSize == 0 ) )
+                return std::string();
+            if ( starts && l < TOPO_LEVELS && !seen.insert( std::vector< int >( places[r].ids, places[r].ids + l + 1 ) ).second )
+                return std::string();
+        }
+
+        const int arity = groups / parentGroups;
+        if ( arity > 1 )
+        {
+            char item[64];
+            sprintf( item, "%s%d:%g", spec.empty() ? "" : ",", arity, l < TOPO_LEVELS ? costs.level[l] : costs.shared );
+            spec += item;
+        }
+        parentGroups = groups;
+    }
+
+    return spec.empty() ? std::string( "1:0" ) : spec;
+}
+
+//--------------------------------------------------------
+// Writes the rank-to-rank distances for DistanceModel::load: the
+// hierarchy of regularTopoSpec() if there is one, otherwise the dense
+// matrix in the comm mtx format.
+
+void saveTopology( const char* fileName, const std::vector< STopoPlace >& places, const STopoCosts& costs )
+{
+    FILE* fp = fopen( fileName, "wb" );
+    if ( !fp )
+        throw std::string( "Problems with topology file. " ).append( __FUNCTION__ );
+
+    const std::string spec = regularTopoSpec( places, costs );
+    if ( !spec.empty() )
+        fprintf( fp, "%s\n", spec.c_str() );
+    else
+    {
+        const long long size = (long long)places.size();
+        fprintf( fp, "%lld %lld %lld\n", size, size, size * ( size - 1 ) );
+        for ( size_t i = 0; i < places.size(); ++i )
+            for ( size_t j = 0; j < places.size(); ++j )
+                if ( i != j )
+                    fprintf( fp, "%d %d %g\n", int( i ), int( j ), costs.distance( places[i], places[j] ) );
+    }
+
+    if ( ferror( fp ) )
+    {
+        fclose( fp );
+        throw std::string( "Error while topology writing. " ).append( __FUNCTION__ );
+    }
+    fclose( fp );
+}
+
+//--------------------------------------------------------
+// Discovers the placement of the ranks of "comm", writes the distances
+// to "fileName" and prints a summary on rank 0.
+
+void writeTopology( MPI_Comm comm, const char* fileName, const char* costsSpec )
+{
+    STopoCosts costs;
+    if ( costsSpec && costsSpec[0] )
+        costs.parse( costsSpec );
+
+    std::vector< STopoPlace > places;
+    std::vector< std::string > nodeNames;
+    discoverTopology( comm, 0, places, nodeNames );
+    if ( places.empty() )
+        return;
+
+    saveTopology( fileName, places, costs );
+
+    int nodes = 0;
+    for ( size_t r = 0; r < places.size(); ++r )
+    {
+        if ( places[r].ids[ TOPO_NODE ] != int( r ) )
+            continue;
+        int ranks = 0;
+        for ( size_t q = 0; q < places.size(); ++q )
+            ranks += places[q].ids[ TOPO_NODE ] == int( r );
+        std::cout << "node " << nodes++ << ": " << nodeNames[r] << ", ranks: " << ranks << "\n";
+    }
+
+    // Ranks free to move between cores; they are placed apart from all
+    // others.
+    int unbound = 0;
+    for ( size_t r = 0; r < places.size(); ++r )
+        unbound += places[r].ids[ TOPO_CORE ] < 0;
+    if ( unbound > 0 )
+        std::cout << "unbound ranks: " << unbound << "\n";
+
+    const std::string spec = regularTopoSpec( places, costs );
+    if ( !spec.empty() )
+        std::cout << "topo: " << spec << "\n";
+    std::cout.flush();
+}
+
+//--------------------------------------------------------
+
+int topology_routine( parparser& args )
+{
+    try
+    {
+        const char* outFile = args.get( "o" ).asString(0);
+        if ( !outFile || !outFile[0] )
+            throw std::string( "Invalid topology file name. " ).append( __FUNCTION__ );
+
+        writeTopology( MPI_COMM_WORLD, outFile, args.get( "topo-costs" ).asString(0) );
+    }
+    catch( std::string err )
+    {
+        std::cerr << "ERROR OCCURED:\n    " << err << "\n";
+        std::cerr.flush();
+    }
+
+    return 0;
+}
+
+//--------------------------------------------------------
+#endif
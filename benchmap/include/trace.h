@@ -0,0 +1,765 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include "mpi.h"
+#include "bintrace.h"
+#include "delay.h"
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+
+//--------------------------------------------------------
+
+struct STraceHeader
+{
+    int procsNum;
+    int bufSize;
+    int sleepTime;
+    int sleepUs;
+    int delayMode;
+    MPI_Offset dataOffset;
+    bool binary;
+    int recordSize;
+
+    // Communicators of collective records as defined by "%comm" lines:
+    // ids and member ranks, the position in the list is the rank inside
+    // the communicator. Id 0 always means all procsNum ranks.
+    std::vector< int > commIds;
+    std::vector< std::vector< int > > commRanks;
+
+    STraceHeader()
+        : procsNum(0)
+        , bufSize(0)
+        , sleepTime(0)
+        , sleepUs(-1)
+        , delayMode(-1)
+        , dataOffset(0)
+        , binary( false )
+        , recordSize(0)
+    {}
+
+    // Delay after every operation in microseconds: "%sleep_us" if present,
+    // otherwise the millisecond "%sleep".
+    int defaultDelayUs() const
+    {
+        return sleepUs >= 0 ? sleepUs : sleepTime * 1000;
+    }
+
+    // Slot of a communicator id: 0 for the world, i + 1 for commIds[i],
+    // -1 if unknown.
+    int commSlot( int id ) const
+    {
+        if ( id == 0 )
+            return 0;
+        for ( size_t i = 0; i < commIds.size(); ++i )
+            if ( commIds[i] == id )
+                return int( i ) + 1;
+        return -1;
+    }
+
+    // Flattens the communicator table into [ id, size, ranks... ]* ints.
+    void packComms( std::vector< int >& out ) const
+    {
+        out.clear();
+        for ( size_t i = 0; i < commIds.size(); ++i )
+        {
+            out.push_back( commIds[i] );
+            out.push_back( int( commRanks[i].size() ) );
+            out.insert( out.end(), commRanks[i].begin(), commRanks[i].end() );
+        }
+    }
+
+    bool unpackComms( const int* data, size_t count )
+    {
+        commIds.clear();
+        commRanks.clear();
+
+        size_t pos = 0;
+        while ( pos + 2 <= count )
+        {
+            const int id = data[ pos ];
+            const int size = data[ pos + 1 ];
+            pos += 2;
+            if ( size < 0 || pos + size > count )
+                return false;
+
+            commIds.push_back( id );
+            commRanks.push_back( std::vector< int >( data + pos, data + pos + size ) );
+            pos += size;
+        }
+        return pos == count;
+    }
+};
+
+// Point-to-point records ('s') send "size" bytes "from" -> "to".
+// Collective records ('a' allreduce, 'b' bcast, 'v' alltoallv) keep the
+// communicator id in "from" and the root in "to"; for alltoallv "size"
+// is the amount sent to every member.
+// Marker records ('r' round, 'p' phase) start interval "from" of the trace,
+// which the simulator times separately; a round marker also synchronizes
+// all ranks.
+// "delay" is the per-record delay in microseconds, -1 if the record has none.
+// "time" is the issue time in microseconds since the start, -1 if none.
+struct STraceRecord
+{
+    char kind;
+    int from;
+    int to;
+    int size;
+    int delay;
+    double time;
+};
+
+//--------------------------------------------------------
+// Parses "#" and "%" lines up to the "-----" separator. Returns false if
+// the separator is not inside [data, data + length).
+
+bool parseTraceHeader( const char* data, size_t length, STraceHeader& header )
+{
+    size_t pos = 0;
+    while ( pos < length )
+    {
+        const char* lineEnd = (const char*)memchr( data + pos, '\n', length - pos );
+        if ( !lineEnd )
+            return false;
+
+        std::string line( data + pos, lineEnd );
+        pos = lineEnd - data + 1;
+
+        const size_t first = line.find_first_not_of( " \t\r" );
+        if ( first == std::string::npos )
+            continue;
+
+        const char symb = line[ first ];
+        if ( symb == '-' )
+        {
+            header.dataOffset = MPI_Offset( pos );
+            return true;
+        }
+        else if ( symb == '%' )
+        {
+            const size_t delim = line.find( ':' );
+            if ( delim == std::string::npos )
+                continue;
+
+            const int value = strtol( line.c_str() + delim + 1, 0, 10 );
+            if ( line.find("transfer_buf") != std::string::npos )
+                header.bufSize = value;
+            else if ( line.find("procs_num") != std::string::npos )
+                header.procsNum = value;
+            else if ( line.find("sleep_us") != std::string::npos )
+                header.sleepUs = value;
+            else if ( line.find("sleep") != std::string::npos )
+                header.sleepTime = value;
+            else if ( line.find("comm") != std::string::npos )
+            {
+                // "%comm: <id> <rank|first-last>..."
+                char* cur = const_cast<char*>( line.c_str() + delim + 1 );
+                char* next = 0;
+                const int id = strtol( cur, &next, 10 );
+                if ( next == cur || id == 0 )
+                    continue;
+
+                std::vector< int > ranks;
+                cur = next;
+                while ( true )
+                {
+                    const int first = strtol( cur, &next, 10 );
+                    if ( next == cur )
+                        break;
+                    int last = first;
+                    cur = next;
+                    if ( *cur == '-' )
+                    {
+                        last = strtol( cur + 1, &next, 10 );
+                        cur = next;
+                    }
+                    for ( int r = first; r <= last; ++r )
+                        ranks.push_back( r );
+                }
+
+                header.commIds.push_back( id );
+                header.commRanks.push_back( ranks );
+            }
+            else if ( line.find("delay_mode") != std::string::npos )
+            {
+                const size_t valueStart = line.find_first_not_of( " \t", delim + 1 );
+                const size_t valueEnd = line.find_last_not_of( " \t\r" );
+                if ( valueStart != std::string::npos && valueEnd >= valueStart )
+                    header.delayMode = parseDelayMode( line.substr( valueStart, valueEnd - valueStart + 1 ).c_str() );
+            }
+        }
+    }
+
+    return false;
+}
+
+//--------------------------------------------------------
+
+bool isTraceRecordKind( char kind )
+{
+    return kind == 's' || kind == 'a' || kind == 'b' || kind == 'v' || kind == 'r' || kind == 'p';
+}
+
+bool isCollectiveKind( char kind )
+{
+    return kind == 'a' || kind == 'b' || kind == 'v';
+}
+
+bool isMarkerKind( char kind )
+{
+    return kind == 'r' || kind == 'p';
+}
+
+// Bytes the record adds to the "#transfered" total: its size for a
+// point-to-point message, collectiveVolume() over its communicator for a
+// collective, nothing for a marker.
+long long recordVolume( const STraceRecord& rec, const STraceHeader& header )
+{
+    if ( isMarkerKind( rec.kind ) )
+        return 0;
+    if ( !isCollectiveKind( rec.kind ) )
+        return rec.size;
+
+    const int slot = header.commSlot( rec.from );
+    if ( slot < 0 )
+        return 0;
+    const int members = slot == 0 ? header.procsNum : int( header.commRanks[ slot - 1 ].size() );
+    return collectiveVolume( rec.kind, rec.size, members );
+}
+
+//--------------------------------------------------------
+// Optional "key=value" tokens after the mandatory fields of a record:
+//     d=<us>    delay after the operation, overrides the trace default
+//     t=<us>    issue time relative to the start of the replay
+
+void parseRecordOptions( const char* cur, const char* lineEnd, STraceRecord& rec )
+{
+    while ( cur < lineEnd )
+    {
+        while ( cur < lineEnd && ( *cur == ' ' || *cur == '\t' ) )
+            ++cur;
+        if ( cur + 1 >= lineEnd || cur[1] != '=' )
+            break;
+
+        char* next = 0;
+        if ( cur[0] == 'd' )
+            rec.delay = strtol( cur + 2, &next, 10 );
+        else if ( cur[0] == 't' )
+            rec.time = strtod( cur + 2, &next );
+        else
+            strtod( cur + 2, &next );
+
+        if ( next == cur + 2 )
+            break;
+        cur = next;
+    }
+}
+
+//--------------------------------------------------------
+// Parses records of every line whose first byte lies in [begin, end).
+// "data" starts at file offset "dataStart" and must contain the whole
+// last line. "lineStart" tells whether "begin" is known to start a line.
+
+void parseTraceLines( const char* data, MPI_Offset dataStart, MPI_Offset begin, MPI_Offset end,
+                      MPI_Offset dataEnd, bool lineStart, std::vector< STraceRecord >& records )
+{
+    MPI_Offset pos = begin;
+    if ( !lineStart )
+    {
+        if ( data[ begin - dataStart - 1 ] != '\n' )
+        {
+            const char* nl = (const char*)memchr( data + ( begin - dataStart ), '\n', size_t( dataEnd - begin ) );
+            if ( !nl )
+                return;
+            pos = ( nl - data ) + dataStart + 1;
+        }
+    }
+
+    while ( pos < end && pos < dataEnd )
+    {
+        const char* line = data + ( pos - dataStart );
+        const char* lineEnd = (const char*)memchr( line, '\n', size_t( dataEnd - pos ) );
+        if ( !lineEnd )
+            lineEnd = data + ( dataEnd - dataStart );
+
+        while ( line < lineEnd && ( *line == ' ' || *line == '\t' ) )
+            ++line;
+
+        if ( line < lineEnd && isTraceRecordKind( *line ) )
+        {
+            char* cur = const_cast<char*>( line + 1 );
+            STraceRecord rec;
+            rec.kind  = *line;
+            rec.from  = strtol( cur, &cur, 10 );
+            rec.to    = strtol( cur, &cur, 10 );
+            rec.size  = strtol( cur, &cur, 10 );
+            rec.delay = -1;
+            rec.time  = -1.0;
+            parseRecordOptions( cur, lineEnd, rec );
+            records.push_back( rec );
+        }
+
+        pos = ( lineEnd - data ) + dataStart + 1;
+    }
+}
+
+//--------------------------------------------------------
+
+bool parseBinTraceHeader( const char* data, size_t length, STraceHeader& header )
+{
+    SBinTraceHeader bin;
+    if ( !readBinTraceHeader( data, length, bin ) )
+        return false;
+    if ( bin.version != BIN_TRACE_VERSION || bin.recordSize < binRecordSize( false, false ) || bin.recordSize > int( sizeof(SBinTraceRecord) ) )
+        return false;
+
+    header.procsNum   = bin.procsNum;
+    header.bufSize    = bin.bufSize;
+    header.sleepTime  = bin.sleepTime;
+    header.sleepUs    = bin.sleepUs;
+    header.delayMode  = bin.delayMode;
+    header.dataOffset = bin.headerSize + MPI_Offset( bin.commTableInts ) * sizeof(int);
+    header.binary     = true;
+    header.recordSize = bin.recordSize;
+
+    if ( size_t( header.dataOffset ) > length )
+        return false;
+
+    if ( bin.commTableInts > 0 )
+    {
+        std::vector< int > table( bin.commTableInts );
+        memcpy( &table[0], data + bin.headerSize, table.size() * sizeof(int) );
+        if ( !header.unpackComms( &table[0], table.size() ) )
+            return false;
+    }
+    return true;
+}
+
+void decodeBinRecords( const char* data, size_t count, int recordSize, std::vector< STraceRecord >& records )
+{
+    records.reserve( records.size() + count );
+    for ( size_t i = 0; i < count; ++i )
+    {
+        SBinTraceRecord bin;
+        readBinRecord( data + i * recordSize, recordSize, bin );
+
+        STraceRecord rec;
+        rec.kind  = bin.kind;
+        rec.from  = bin.from;
+        rec.to    = bin.to;
+        rec.size  = bin.size;
+        rec.delay = bin.delay;
+        rec.time  = bin.time;
+        records.push_back( rec );
+    }
+}
+
+//--------------------------------------------------------
+// Reads [begin, end) of the file plus the tail of the line that crosses "end".
+
+MPI_Offset readTracePiece( MPI_File fp, MPI_Offset begin, MPI_Offset end, MPI_Offset fileSize, std::string& buf )
+{
+    const MPI_Offset tailStep = 4096;
+    MPI_Offset readEnd = end;
+    buf.clear();
+
+    MPI_Offset pos = begin;
+    while ( true )
+    {
+        if ( readEnd > fileSize )
+            readEnd = fileSize;
+
+        buf.resize( size_t( readEnd - begin ) );
+
+        while ( pos < readEnd )
+        {
+            const MPI_Offset maxChunk = 1 << 30;
+            const int count = int( readEnd - pos < maxChunk ? readEnd - pos : maxChunk );
+            MPI_Status status;
+            MPI_File_read_at( fp, pos, &buf[ size_t( pos - begin ) ], count, MPI_CHAR, &status );
+            pos += count;
+        }
+
+        if ( readEnd == fileSize )
+            break;
+
+        const size_t searchFrom = size_t( end - begin - 1 );
+        if ( memchr( &buf[ searchFrom ], '\n', buf.size() - searchFrom ) )
+            break;
+
+        readEnd += tailStep;
+    }
+
+    return readEnd;
+}
+
+//--------------------------------------------------------
+// Reads a growing prefix of the file until the whole header fits in it.
+
+bool probeTraceHeader( MPI_File fp, MPI_Offset fileSize, STraceHeader& header )
+{
+    std::string buf;
+    MPI_Offset probe = 4096;
+    while ( true )
+    {
+        const MPI_Offset len = probe < fileSize ? probe : fileSize;
+        buf.resize( size_t( len ) );
+        MPI_Status status;
+        if ( len > 0 )
+            MPI_File_read_at( fp, 0, &buf[0], int( len ), MPI_CHAR, &status );
+
+        if ( isBinTrace( buf.c_str(), buf.size() ) )
+        {
+            if ( parseBinTraceHeader( buf.c_str(), buf.size(), header ) || len == fileSize )
+                break;
+        }
+        else if ( parseTraceHeader( buf.c_str(), buf.size(), header ) || len == fileSize )
+            break;
+        probe *= 2;
+    }
+
+    return header.dataOffset > 0;
+}
+
+//--------------------------------------------------------
+// Reads the whole trace piece by piece on a single process, for the tools
+// that need every record rather than the ones of one rank.
+
+class TraceReader
+{
+public:
+    TraceReader()
+        : m_fp( MPI_FILE_NULL )
+        , m_fileSize( 0 )
+        , m_pos( 0 )
+        , m_pieceSize( 0 )
+    {}
+
+    ~TraceReader() { close(); }
+
+    void open( const char* fileName, MPI_Offset pieceSize )
+    {
+        close();
+
+        if ( MPI_SUCCESS != MPI_File_open( MPI_COMM_SELF, const_cast<char*>(fileName), MPI_MODE_RDONLY, MPI_INFO_NULL, &m_fp ) )
+        {
+            m_fp = MPI_FILE_NULL;
+            throw std::string( "Problems with trace file. " ).append( __FUNCTION__ );
+        }
+
+        MPI_File_get_size( m_fp, &m_fileSize );
+        m_header = STraceHeader();
+        if ( !probeTraceHeader( m_fp, m_fileSize, m_header ) )
+            throw std::string( "Invalid trace header. " ).append( __FUNCTION__ );
+
+        m_pos = m_header.dataOffset;
+        m_pieceSize = pieceSize > 0 ? pieceSize : 1;
+        if ( m_header.binary )
+        {
+            if ( !m_mapping.open( fileName ) )
+                throw std::string( "Problems with trace file. " ).append( __FUNCTION__ );
+
+            const MPI_Offset recsPerPiece = m_pieceSize / m_header.recordSize;
+            m_pieceSize = ( recsPerPiece > 0 ? recsPerPiece : 1 ) * m_header.recordSize;
+        }
+    }
+
+    const STraceHeader& header() const { return m_header; }
+
+    // Replaces "records" with the next piece; false once the file is over.
+    bool next( std::vector< STraceRecord >& records )
+    {
+        records.clear();
+        if ( m_fp == MPI_FILE_NULL || m_pos >= m_fileSize )
+            return false;
+
+        const MPI_Offset begin = m_pos;
+        const MPI_Offset end = begin + m_pieceSize < m_fileSize ? begin + m_pieceSize : m_fileSize;
+        m_pos = end;
+
+        if ( m_header.binary )
+        {
+            const size_t count = size_t( ( end - begin ) / m_header.recordSize );
+            const char* data = m_mapping.map( begin, count * m_header.recordSize );
+            if ( count > 0 && !data )
+                throw std::string( "Problems with trace mapping. " ).append( __FUNCTION__ );
+
+            decodeBinRecords( data, count, m_header.recordSize, records );
+            m_mapping.unmap();
+        }
+        else
+        {
+            const bool lineStart = ( begin == m_header.dataOffset );
+            const MPI_Offset readBegin = lineStart ? begin : begin - 1;
+            const MPI_Offset readEnd = readTracePiece( m_fp, readBegin, end, m_fileSize, m_buf );
+            parseTraceLines( m_buf.c_str(), readBegin, begin, end, readEnd, lineStart, records );
+        }
+
+        return true;
+    }
+
+    void close()
+    {
+        m_mapping.close();
+        if ( m_fp != MPI_FILE_NULL )
+            MPI_File_close( &m_fp );
+        m_fp = MPI_FILE_NULL;
+    }
+
+private:
+    MPI_File m_fp;
+    MPI_Offset m_fileSize;
+    MPI_Offset m_pos;
+    MPI_Offset m_pieceSize;
+    STraceHeader m_header;
+    TraceMapping m_mapping;
+    std::string m_buf;
+};
+
+//--------------------------------------------------------
+// Ranks below "commSize" that take part in the record.
+
+void recordTargets( const STraceRecord& rec, const STraceHeader& header, int commSize, std::vector< int >& targets )
+{
+    targets.clear();
+
+    if ( !isCollectiveKind( rec.kind ) && !isMarkerKind( rec.kind ) )
+    {
+        if ( rec.from >= 0 && rec.from < commSize )
+            targets.push_back( rec.from );
+        if ( rec.to >= 0 && rec.to < commSize && rec.to != rec.from )
+            targets.push_back( rec.to );
+        return;
+    }
+
+    const int slot = isMarkerKind( rec.kind ) ? 0 : header.commSlot( rec.from );
+    if ( slot == 0 )
+    {
+        const int last = header.procsNum < commSize ? header.procsNum : commSize;
+        for ( int r = 0; r < last; ++r )
+            targets.push_back( r );
+    }
+    else if ( slot > 0 )
+    {
+        const std::vector< int >& ranks = header.commRanks[ slot - 1 ];
+        for ( size_t i = 0; i < ranks.size(); ++i )
+            if ( ranks[i] >= 0 && ranks[i] < commSize )
+                targets.push_back( ranks[i] );
+    }
+}
+
+//--------------------------------------------------------
+// Replaces trace ranks by the ranks of "comm" hosting them; ranks the
+// placement does not cover are dropped.
+
+void placeTargets( const std::vector< int >* placement, std::vector< int >& targets )
+{
+    if ( !placement )
+        return;
+
+    size_t kept = 0;
+    for ( size_t i = 0; i < targets.size(); ++i )
+        if ( size_t( targets[i] ) < placement->size() )
+            targets[ kept++ ] = ( *placement )[ targets[i] ];
+    targets.resize( kept );
+}
+
+//--------------------------------------------------------
+// True if "failed" is set on any rank of "comm". Every rank calls it at the
+// same point, so they all give up together instead of leaving the others
+// blocked in the next collective.
+
+bool anyRankFailed( MPI_Comm comm, bool failed )
+{
+    int local = failed ? 1 : 0;
+    int global = 0;
+    MPI_Allreduce( &local, &global, 1, MPI_INT, MPI_MAX, comm );
+    return global != 0;
+}
+
+//--------------------------------------------------------
+// Every rank reads only a slice of the trace and forwards each record to
+// its sender and receiver, collectives to every member of their
+// communicator. Pieces are dealt round-robin and exchanged in rounds, so
+// the records arrive in file order and no rank ever holds more than one
+// piece of raw text plus its own events. Binary traces are mapped instead
+// of read, with pieces rounded down to whole records. If "placement" is
+// given, trace rank r is hosted by rank placement[r] of "comm".
+
+void loadTracePartitioned( MPI_Comm comm, const char* fileName, MPI_Offset pieceSize,
+                           STraceHeader& header, std::vector< STraceRecord >& records,
+                           const std::vector< int >* placement = 0 )
+{
+    int rank = 0;
+    int commSize = 0;
+    MPI_Comm_rank( comm, &rank );
+    MPI_Comm_size( comm, &commSize );
+
+    MPI_File fp = MPI_FILE_NULL;
+    if ( MPI_SUCCESS != MPI_File_open( comm, const_cast<char*>(fileName), MPI_MODE_RDONLY, MPI_INFO_NULL, &fp ) )
+        throw std::string( "Problems with trace file. " ).append( __FUNCTION__ );
+
+    MPI_Offset fileSize = 0;
+    MPI_File_get_size( fp, &fileSize );
+
+    long long headerData[8] = { 0, 0, 0, -1, 0, 0, -1, -1 };
+    if ( rank == 0 )
+    {
+        if ( probeTraceHeader( fp, fileSize, header ) )
+        {
+            headerData[0] = header.procsNum;
+            headerData[1] = header.bufSize;
+            headerData[2] = header.sleepTime;
+            headerData[3] = header.dataOffset;
+            headerData[4] = header.binary ? 1 : 0;
+            headerData[5] = header.recordSize;
+            headerData[6] = header.sleepUs;
+            headerData[7] = header.delayMode;
+        }
+    }
+
+    MPI_Bcast( headerData, 8, MPI_LONG_LONG, 0, comm );
+    if ( headerData[3] < 0 )
+    {
+        MPI_File_close( &fp );
+        throw std::string( "Invalid trace header. " ).append( __FUNCTION__ );
+    }
+
+    header.procsNum   = int( headerData[0] );
+    header.bufSize    = int( headerData[1] );
+    header.sleepTime  = int( headerData[2] );
+    header.dataOffset = MPI_Offset( headerData[3] );
+    header.binary     = headerData[4] != 0;
+    header.recordSize = int( headerData[5] );
+    header.sleepUs    = int( headerData[6] );
+    header.delayMode  = int( headerData[7] );
+
+    std::vector< int > commTable;
+    if ( rank == 0 )
+        header.packComms( commTable );
+    int commTableSize = int( commTable.size() );
+    MPI_Bcast( &commTableSize, 1, MPI_INT, 0, comm );
+    commTable.resize( commTableSize );
+    if ( commTableSize > 0 )
+        MPI_Bcast( &commTable[0], commTableSize, MPI_INT, 0, comm );
+    if ( rank != 0 )
+        header.unpackComms( commTable.empty() ? 0 : &commTable[0], commTable.size() );
+
+    TraceMapping mapping;
+    if ( header.binary )
+    {
+        if ( anyRankFailed( comm, !mapping.open( fileName ) ) )
+        {
+            MPI_File_close( &fp );
+            throw std::string( "Problems with trace file. " ).append( __FUNCTION__ );
+        }
+
+        const MPI_Offset recsPerPiece = pieceSize / header.recordSize;
+        pieceSize = ( recsPerPiece > 0 ? recsPerPiece : 1 ) * header.recordSize;
+    }
+
+    MPI_Datatype recordType;
+    MPI_Type_contiguous( sizeof(STraceRecord), MPI_BYTE, &recordType );
+    MPI_Type_commit( &recordType );
+
+    const MPI_Offset bodySize = fileSize - header.dataOffset;
+    const MPI_Offset piecesNum = ( bodySize + pieceSize - 1 ) / pieceSize;
+    const MPI_Offset roundsNum = ( piecesNum + commSize - 1 ) / commSize;
+
+    std::string buf;
+    std::vector< STraceRecord > parsed;
+    std::vector< STraceRecord > outgoing;
+    std::vector< int > targets;
+    std::vector< int > sendCounts( commSize );
+    std::vector< int > sendDispls( commSize );
+    std::vector< int > recvCounts( commSize );
+    std::vector< int > recvDispls( commSize );
+
+    for ( MPI_Offset round = 0; round < roundsNum; ++round )
+    {
+        parsed.clear();
+        bool failed = false;
+
+        const MPI_Offset piece = round * commSize + rank;
+        const MPI_Offset begin = header.dataOffset + piece * pieceSize;
+        if ( begin < fileSize && header.binary )
+        {
+            const MPI_Offset end = begin + pieceSize < fileSize ? begin + pieceSize : fileSize;
+            const size_t count = size_t( ( end - begin ) / header.recordSize );
+            const char* data = mapping.map( begin, count * header.recordSize );
+            if ( count > 0 && !data )
+                failed = true;
+            else
+                decodeBinRecords( data, count, header.recordSize, parsed );
+            mapping.unmap();
+        }
+        else if ( begin < fileSize )
+        {
+            const MPI_Offset end = begin + pieceSize < fileSize ? begin + pieceSize : fileSize;
+            const bool lineStart = ( begin == header.dataOffset );
+            const MPI_Offset readBegin = lineStart ? begin : begin - 1;
+
+            const MPI_Offset readEnd = readTracePiece( fp, readBegin, end, fileSize, buf );
+            parseTraceLines( buf.c_str(), readBegin, begin, end, readEnd, lineStart, parsed );
+        }
+
+        if ( header.binary && anyRankFailed( comm, failed ) )
+        {
+            MPI_Type_free( &recordType );
+            MPI_File_close( &fp );
+            throw std::string( "Problems with trace mapping. " ).append( __FUNCTION__ );
+        }
+
+        std::fill( sendCounts.begin(), sendCounts.end(), 0 );
+        for ( size_t i = 0; i < parsed.size(); ++i )
+        {
+            recordTargets( parsed[i], header, commSize, targets );
+            placeTargets( placement, targets );
+            for ( size_t t = 0; t < targets.size(); ++t )
+                ++sendCounts[ targets[t] ];
+        }
+
+        int total = 0;
+        for ( int i = 0; i < commSize; ++i )
+        {
+            sendDispls[i] = total;
+            total += sendCounts[i];
+        }
+
+        outgoing.resize( total );
+        std::vector< int > fill( sendDispls );
+        for ( size_t i = 0; i < parsed.size(); ++i )
+        {
+            recordTargets( parsed[i], header, commSize, targets );
+            placeTargets( placement, targets );
+            for ( size_t t = 0; t < targets.size(); ++t )
+                outgoing[ fill[ targets[t] ]++ ] = parsed[i];
+        }
+
+        MPI_Alltoall( &sendCounts[0], 1, MPI_INT, &recvCounts[0], 1, MPI_INT, comm );
+
+        total = 0;
+        for ( int i = 0; i < commSize; ++i )
+        {
+            recvDispls[i] = total;
+            total += recvCounts[i];
+        }
+
+        const size_t oldSize = records.size();
+        records.resize( oldSize + total );
+        STraceRecord* sendBuf = outgoing.empty() ? 0 : &outgoing[0];
+        STraceRecord* recvBuf = total == 0 ? 0 : &records[ oldSize ];
+        MPI_Alltoallv( sendBuf, &sendCounts[0], &sendDispls[0], recordType,
+                       recvBuf, &recvCounts[0], &recvDispls[0], recordType, comm );
+    }
+
+    MPI_Type_free( &recordType );
+    MPI_File_close( &fp );
+}
+
+//--------------------------------------------------------
+#endif
@@ -0,0 +1,180 @@
+#ifndef TRACEWRITER_H
+#define TRACEWRITER_H
+
+#include "bintrace.h"
+#include "mpi.h"
+
+#include <string>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+
+#pragma warning(disable : 4996)
+
+//--------------------------------------------------------
+// Formats trace records into a fixed pair of buffers. In counting mode it
+// only measures the output, so a rank can learn its file offset and the
+// number of writes before writing anything. In writing mode a full buffer
+// is handed to MPI_File_iwrite_at_all and filled again only once that
+// write completes, while records go into the other one, so memory stays at
+// two buffers whatever the trace size. The writes are collective, so
+// finish() pads a rank with empty writes up to the count of the busiest
+// rank.
+
+class TraceWriter
+{
+public:
+    // Binary records are "recordSize" bytes, see binRecordSize().
+    TraceWriter( bool binary, size_t bufferSize, int recordSize = sizeof(SBinTraceRecord) )
+        : m_binary( binary )
+        , m_recordSize( size_t( recordSize ) )
+        , m_fp( MPI_FILE_NULL )
+        , m_offset( 0 )
+        , m_current( 0 )
+        , m_used( 0 )
+        , m_writes( 0 )
+        , m_collectiveWrites( 0 )
+        , m_length( 0 )
+        , m_records( 0 )
+        , m_maxSize( 0 )
+    {
+        m_pending[0] = MPI_REQUEST_NULL;
+        m_pending[1] = MPI_REQUEST_NULL;
+        m_bufferSize = bufferSize > 256 ? bufferSize : 256;
+    }
+
+    ~TraceWriter() { wait(); }
+
+    void startCounting()
+    {
+        wait();
+        m_fp = MPI_FILE_NULL;
+        m_used = 0;
+        m_writes = 0;
+        m_length = 0;
+        m_records = 0;
+        m_maxSize = 0;
+    }
+
+    // Every rank of "fp" must pass the same "writes", at least the writes()
+    // its own output was counted at.
+    void startWriting( MPI_File fp, MPI_Offset offset, long long writes )
+    {
+        wait();
+        m_fp = fp;
+        m_offset = offset;
+        m_used = 0;
+        m_writes = 0;
+        m_collectiveWrites = writes;
+        m_length = 0;
+        m_records = 0;
+        m_maxSize = 0;
+        for ( int i = 0; i < 2; ++i )
+            m_buffers[i].resize( m_bufferSize );
+    }
+
+    // Bytes, records, buffer writes and the largest record size emitted
+    // since the last start.
+    long long length() const { return m_length; }
+    long long writes() const { return m_writes; }
+    long long records() const { return m_records; }
+    int maxSize() const { return m_maxSize; }
+
+    // "delay" is written only if not negative.
+    void record( char kind, int from, int to, int size, int delay = -1 )
+    {
+        char text[64];
+        const char* data = text;
+        size_t len = 0;
+
+        SBinTraceRecord bin;
+        if ( m_binary )
+        {
+            fillBinRecord( bin, kind, from, to, size, delay );
+            data = (const char*)&bin;
+            len = m_recordSize;
+        }
+        else if ( delay >= 0 )
+            len = size_t( sprintf( text, "%c %d %d %d d=%d\n", kind, from, to, size, delay ) );
+        else
+            len = size_t( sprintf( text, "%c %d %d %d\n", kind, from, to, size ) );
+
+        append( data, len );
+        ++m_records;
+        if ( size > m_maxSize )
+            m_maxSize = size;
+    }
+
+    void append( const char* data, size_t len )
+    {
+        m_length += (long long)len;
+        if ( m_used + len > m_bufferSize )
+            flush();
+        if ( m_fp != MPI_FILE_NULL )
+            memcpy( &m_buffers[ m_current ][ m_used ], data, len );
+        m_used += len;
+    }
+
+    // Writes out what is buffered and waits for all writes. In counting
+    // mode it only ends the current write, as writing mode would.
+    void finish()
+    {
+        flush();
+        if ( m_fp != MPI_FILE_NULL )
+        {
+            for ( ; m_writes < m_collectiveWrites; ++m_writes )
+                post( 0 );
+        }
+        wait();
+    }
+
+private:
+    void flush()
+    {
+        if ( m_used == 0 )
+            return;
+
+        if ( m_fp != MPI_FILE_NULL )
+            post( m_used );
+        ++m_writes;
+        m_used = 0;
+    }
+
+    void post( size_t len )
+    {
+        MPI_File_iwrite_at_all( m_fp, m_offset, &m_buffers[ m_current ][0], int( len ), MPI_CHAR, &m_pending[ m_current ] );
+        m_offset += MPI_Offset( len );
+
+        m_current = 1 - m_current;
+        if ( m_pending[ m_current ] != MPI_REQUEST_NULL )
+            MPI_Wait( &m_pending[ m_current ], MPI_STATUS_IGNORE );
+    }
+
+    void wait()
+    {
+        for ( int i = 0; i < 2; ++i )
+            if ( m_pending[i] != MPI_REQUEST_NULL )
+                MPI_Wait( &m_pending[i], MPI_STATUS_IGNORE );
+    }
+
+private:
+    bool m_binary;
+    size_t m_recordSize;
+    MPI_File m_fp;
+    MPI_Offset m_offset;
+
+    size_t m_bufferSize;
+    std::vector< char > m_buffers[2];
+    MPI_Request m_pending[2];
+    int m_current;
+    size_t m_used;
+    long long m_writes;
+    long long m_collectiveWrites;
+
+    long long m_length;
+    long long m_records;
+    int m_maxSize;
+};
+
+//--------------------------------------------------------
+#endif
@@ -1,6 +1,11 @@
 #include <iostream>
 #include "generator.h"
 #include "simulator.h"
+#include "converter.h"
+#include "mapping.h"
+#include "topology.h"
+#include "evaluator.h"
+#include "netsim.h"
 #include "parparser.h"
 #include "mpi.h"
 
@@ -12,8 +17,27 @@ int main( int argc, char** argv )
 
     parparser parameters( argc, argv );
     bool generate = parameters.get( "g" ).asBool( false );
+    bool convert = parameters.get( "c" ).asBool( false );
+    bool mapper = parameters.get( "mapper" ).asBool( false );
+    bool discover = parameters.get( "discover" ).asBool( false );
+    bool evaluate = parameters.get( "evaluate" ).asBool( false );
+    bool netsim = parameters.get( "netsim" ).asBool( false );
 
-    int retCode = generate ? generator_routine( parameters ) : simulator_routine( parameters );
+    int retCode = 0;
+    if ( generate )
+        retCode = generator_routine( parameters );
+    else if ( convert )
+        retCode = converter_routine( parameters );
+    else if ( mapper )
+        retCode = mapper_routine( parameters );
+    else if ( discover )
+        retCode = topology_routine( parameters );
+    else if ( evaluate )
+        retCode = evaluator_routine( parameters );
+    else if ( netsim )
+        retCode = netsim_routine( parameters );
+    else
+        retCode = simulator_routine( parameters );
 
     MPI_Finalize();
     return retCode;